@@ -1,15 +1,17 @@
 #include "Boids.h"
-#include <iostream>
-#include "Urho3D/IO/Log.h"
-
-float Boids::Range_FAttract = 30.0f;
-float Boids::Range_FRepel = 20.0f;
-float Boids::Range_FAlign = 5.0f;
-float Boids::FAttract_Vmax = 5.0f;
-float Boids::FAttract_Factor = 4.0f;
-float Boids::FRepel_Factor = 2.0f;
-float Boids::FAlign_Factor = 2.0f;
-Vector<Vector<Vector<int>>> BoidsGrid;
+#include "TickProfile.h"
+
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/RigidBody.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
 
 Boids::Boids()
 {
@@ -17,309 +19,506 @@ Boids::Boids()
 	pCollsionShape = nullptr;
 	pRigidBody = nullptr;
 	pObject = nullptr;
+	id = 0;
+	school = 0;
 }
 
 Boids::~Boids()
 {
 }
 
-void Boids::Initialise(ResourceCache * pRes, Scene * pScene)
+void Boids::Initialise(ResourceCache * pRes, Scene * pScene, bool kinematic)
 {
 	float scale = 1.5f;
-	pNode = pScene->CreateChild("Cone");
-	pNode->SetPosition(Vector3(Random(180.0f) - 90.0f, 20.0f,Random(180.0f) - 90.0f));
-	pObject = pNode->CreateComponent<StaticModel>();
-	pRigidBody = pNode->CreateComponent<RigidBody>();
-	pRigidBody->SetUseGravity(false);
-	pRigidBody->SetLinearVelocity(Vector3(Random(20.0f), 0.0f, Random(20.0f)));
-	pRigidBody->SetMass(0.5f);
+	//boids reach clients through the flock snapshot messages, not scene replication
+	pNode = pScene->CreateChild("Cone", LOCAL);
+	pObject = pNode->CreateComponent<StaticModel>(LOCAL);
 	pObject->SetModel(pRes->GetResource<Model>("Models/Cone.mdl"));
 	pObject->SetMaterial(pRes->GetResource<Material>("Materials/Mushroom.xml"));
 	pObject->SetCastShadows(false);
 	
-	
-	
-	
-	pCollsionShape = pNode->CreateComponent<CollisionShape>();
-	pCollsionShape->SetConvexHull(pObject->GetModel());
+	//kinematic boids are moved by BoidSet::Integrate and never enter the physics world
+	if (!kinematic)
+	{
+		pRigidBody = pNode->CreateComponent<RigidBody>(LOCAL);
+		pRigidBody->SetUseGravity(false);
+		pRigidBody->SetMass(BOID_MASS);
+		pRigidBody->SetCollisionLayer(BOID_COLLISION_LAYER);
+		pRigidBody->SetCollisionMask(M_MAX_UNSIGNED & ~PLAYER_COLLISION_LAYER);
+		pCollsionShape = pNode->CreateComponent<CollisionShape>(LOCAL);
+		pCollsionShape->SetConvexHull(pObject->GetModel());
+	}
+	pNode->SetEnabled(false);
 	
 }
 
-void Boids::ComputeForce(Boids * boid)
+void Boids::Spawn(const Vector3& position, const Vector3& velocity)
 {
-	Vector3 Pmean, Vmean;
-	int Pn = 0;
-	int Vn = 0;
-	Force = Vector3(0.0f, 0.0f, 0.0f);
-	Vector3 FS, FC, FA;
-	//printf("Neighbours: %i \n", NeighbourVec.Size());
-	//search Neighbourhood
-	//Vector3 Vec = pRigidBody->GetPosition() - boid[NeighbourVec[0]].pRigidBody->GetPosition();
-	//float d = Vec.Length();
-	//printf("Vec Length: %f \n" ,d);
-
-	//TODO: Problem with boidlist element 98 y axis is not a number for some reason;
-	//for (int x = 0; x < Numboids; x++)
-	for(int x =0; x < NeighbourVec.Size();x++)
-	{
-		int Index = NeighbourVec[x];
-		//the current boid?
-		//if (this == &boid[x]) continue;
-		//sep = vector position of this boid from current boid
-		Vector3 sep = pRigidBody->GetPosition() - boid[Index].pRigidBody->GetPosition();
-		float d = sep.Length();//distance of boid
-		//printf("Vec Length: %f \n" ,d);
-		if (d < Range_FAttract)
-		{
-			//with range,so is a neighbour
-			Pmean += boid[Index].pRigidBody->GetPosition();
-			Pn++;
-		}
-		
-		if (d < Range_FAlign)
-		{
-			//with range,so is a neighbour
-			Vmean += boid[Index].pRigidBody->GetLinearVelocity();
-			Vn++;
-		}
-		if (d < Range_FRepel)
-		{
-			FS += sep / d;
-		}
-
-	}
-	//Cohension force component
-	if (Pn > 0)
-	{
-		//find average position = centre of mass
-		Pmean /= Pn;
-		Vector3 dir = (Pmean - pRigidBody->GetPosition()).Normalized();
-		Vector3 vDesired = dir*FAttract_Vmax;
-		FC = (vDesired - pRigidBody->GetLinearVelocity())*FAttract_Factor;
-	}
-	//Alligment
-	if (Vn > 0)
+	pNode->SetEnabled(true);
+	pNode->SetPosition(position);
+	if (pRigidBody)
 	{
-		Vmean /= Vn;
-		FA = FAlign_Factor*(Vmean - pRigidBody->GetLinearVelocity());
+		pRigidBody->SetPosition(position);
+		pRigidBody->SetLinearVelocity(velocity);
 	}
+}
 
-	//Seperation
-	FS *= FRepel_Factor;
+void Boids::Despawn()
+{
+	if (pRigidBody)
+		pRigidBody->SetLinearVelocity(Vector3::ZERO);
+	pNode->SetEnabled(false);
+}
 
-	Force = FA + FC + FS;
+void Boids::ReadState(FlockState& state, int index) const
+{
+	Vector3 p = pRigidBody->GetPosition();
+	Vector3 v = pRigidBody->GetLinearVelocity();
+	state.px[index] = p.x_;
+	state.py[index] = p.y_;
+	state.pz[index] = p.z_;
+	state.vx[index] = v.x_;
+	state.vy[index] = v.y_;
+	state.vz[index] = v.z_;
+}
+
+Quaternion Boids::HeadingRotation(const Vector3& vel)
+{
+	Vector3 vn = vel.Normalized();
+	Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
+	float dp = cp.DotProduct(vn);
+	return Quaternion(Acos(dp), cp);
 }
 
-void Boids::Update(float Num)
+void Boids::Update(const FlockState& state, int index)
 {
-	pRigidBody->ApplyForce(Force);
-	Vector3 vel = pRigidBody->GetLinearVelocity();
+	pRigidBody->ApplyForce(Vector3(state.fx[index], state.fy[index], state.fz[index]));
+	Vector3 vel(state.vx[index], state.vy[index], state.vz[index]);
 	float d = vel.Length();
-	if (d < 10.0f)
+	if (d < BOID_MIN_SPEED)
 	{
-		d = 10.0f;
+		d = BOID_MIN_SPEED;
 		pRigidBody->SetLinearVelocity(vel.Normalized()*d);
 	}
-	else if (d > 50.0f)
+	else if (d > BOID_MAX_SPEED)
 	{
-		d = 50.0f;
+		d = BOID_MAX_SPEED;
 		pRigidBody->SetLinearVelocity(vel.Normalized()*d);
 	}
-	Vector3 vn = vel.Normalized();
-	Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
-	float dp = cp.DotProduct(vn);
-	pRigidBody->SetRotation(Quaternion(Acos(dp), cp));
+	pRigidBody->SetRotation(HeadingRotation(vel));
 
-	Vector3 p = pRigidBody->GetPosition();
-	if (p.y_ < 10.0f)
+	//turn back off the floor and the surface, the tank walls do that for X and Z
+	Vector3 p(state.px[index], state.py[index], state.pz[index]);
+	if (p.y_ < BOID_MIN_Y || p.y_ > BOID_MAX_Y)
 	{
-		p.y_ = 10.0f;
-		pRigidBody->SetPosition(p);
-	}
-	else if (p.y_ > 50.0f)
-	{
-		p.y_ = 50.0f;
+		p.y_ = Clamp(p.y_, BOID_MIN_Y, BOID_MAX_Y);
 		pRigidBody->SetPosition(p);
+		vel = pRigidBody->GetLinearVelocity();
+		vel.y_ = -vel.y_;
+		pRigidBody->SetLinearVelocity(vel);
 	}
 
 	
 }
 
-void Boids::FindNeighbours(Boids* boid)
+void Boids::WriteTransform(const FlockState& state, int index)
 {
-	NeighbourVec.Clear();
-	//get current boid grid position
-	Vector3 Pos = pRigidBody->GetPosition();
-
-	//plus 100 to make all values positive
-	int x = Pos.x_ + 100;
-	int z = Pos.z_ + 100;
-	//divide by 20 to get grid position
-	int GridX = x / 10;
-	int GridZ = z / 10;
-
-	if (GridZ > 19 || GridX > 19 || GridX < 0 || GridZ < 0)
+	Vector3 vel(state.vx[index], state.vy[index], state.vz[index]);
+	pNode->SetTransform(Vector3(state.px[index], state.py[index], state.pz[index]) + correction, HeadingRotation(vel));
+	//ease a corrected boid onto its new path over a few steps instead of snapping it there
+	correction *= 0.9f;
+}
+
+BoidSet::BoidSet()
+{
+	pRes_ = nullptr;
+	pScene_ = nullptr;
+	workQueue_ = nullptr;
+	indexValid_ = false;
+	index = CreateFlockIndex(FLOCK_INDEX_GRID, indexSettings_);
+	nextSchool = 0;
+	nextId = 0;
+	tick = 0;
+	numEaten = 0;
+	numRespawned = 0;
+}
+
+BoundingBox BoidSet::GetBounds() const
+{
+	return BoundingBox(Vector3(settings_.minX, BOID_MIN_Y, settings_.minZ), Vector3(settings_.maxX, BOID_MAX_Y, settings_.maxZ));
+}
+
+void BoidSet::Initialise(ResourceCache * pRes, Scene * pScene, const FlockSettings& settings)
+{
+	pRes_ = pRes;
+	pScene_ = pScene;
+
+	settings_ = settings;
+	indexSettings_.type = settings.indexType;
+	indexSettings_.cellSize = settings.cellSize;
+	indexSettings_.minX = settings.minX;
+	indexSettings_.minY = BOID_MIN_Y;
+	indexSettings_.minZ = settings.minZ;
+	indexSettings_.maxX = settings.maxX;
+	indexSettings_.maxY = BOID_MAX_Y;
+	indexSettings_.maxZ = settings.maxZ;
+	indexSettings_.incremental = settings.incrementalGrid;
+	//auto mode runs on the uniform grid until it first measures the flock
+	SetIndexType(settings.indexType == FLOCK_INDEX_AUTO ? FLOCK_INDEX_GRID : settings.indexType);
+	params_.searchRadius = settings.cellSize;
+	params_.minX = settings.minX;
+	params_.minZ = settings.minZ;
+	params_.maxX = settings.maxX;
+	params_.maxZ = settings.maxZ;
+	params_.maxNeighbours = settings.maxNeighbours;
+	params_.useSimd = settings.useSimd;
+	params_.farField = settings.farField;
+	verletLists_.SetSkin(settings.verletSkin);
+	workQueue_ = pScene->GetSubsystem<WorkQueue>();
+
+	//reserve up front so spawning and despawning during play does not reallocate
+	unsigned numBoids = settings.numBoids;
+	boidList.Reserve(numBoids);
+	pool.Reserve(numBoids);
+	state.Reserve(numBoids);
+
+	if (numBoids > 0)
+		SpawnSchool(numBoids, Vector3(0.0f, BOID_SPAWN_Y, 0.0f), 90.0f);
+}
+
+unsigned BoidSet::SpawnSchool(unsigned count, const Vector3 & centre, float spread)
+{
+	unsigned school = nextSchool++;
+	for (unsigned x = 0; x < count; x++)
 	{
-		
-		return;
+		//reuse the id of a parked boid before making a new one
+		unsigned id = pool.Empty() ? nextId++ : pool.Back().id;
+		SpawnBoid(id, school, centre, spread);
 	}
-	//checking current grid square 
-	for (int i = 0; i < BoidsGrid[GridX][GridZ].Size(); i++)
+	schools.Push(school);
+	return school;
+}
+
+//integer hash of three values, the same on every machine unlike Random()
+static unsigned FlockHash(unsigned a, unsigned b, unsigned c)
+{
+	unsigned h = a * 0x9e3779b1u ^ b * 0x85ebca77u ^ c * 0xc2b2ae3du;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return h;
+}
+
+//uniform in [0, 1) from the top 24 bits of a hash
+static float HashUnit(unsigned h)
+{
+	return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+void BoidSet::SpawnBoid(unsigned id, unsigned school, const Vector3 & centre, float spread)
+{
+	unsigned key = tick * 8;
+	//the school spreads up and down as far as the water column allows
+	float spreadY = Min(spread, 0.5f * (BOID_MAX_Y - BOID_MIN_Y));
+	float y = centre.y_ + (2.0f * HashUnit(FlockHash(settings_.seed, id, key + 4)) - 1.0f) * spreadY;
+	Vector3 position(centre.x_ + (2.0f * HashUnit(FlockHash(settings_.seed, id, key)) - 1.0f) * spread,
+		Clamp(y, BOID_MIN_Y, BOID_MAX_Y), centre.z_ + (2.0f * HashUnit(FlockHash(settings_.seed, id, key + 1)) - 1.0f) * spread);
+	Vector3 velocity(20.0f * HashUnit(FlockHash(settings_.seed, id, key + 2)),
+		10.0f * HashUnit(FlockHash(settings_.seed, id, key + 5)) - 5.0f, 20.0f * HashUnit(FlockHash(settings_.seed, id, key + 3)));
+	AddBoid(id, school, position, velocity);
+
+	if (settings_.recordEvents)
 	{
-		
-		if (this == &boid[BoidsGrid[GridX][GridZ][i]]);
-		{
-			continue;
-		}
-		NeighbourVec.Push(BoidsGrid[GridX][GridZ][i]);
+		FlockEvent event;
+		event.type = FLOCK_EVENT_SPAWN;
+		event.tick = tick;
+		event.id = id;
+		event.school = school;
+		event.centre = centre;
+		event.spread = spread;
+		events.Push(event);
 	}
-	
-	//checking adjacent grid squares
-	if (GridX < 19)
+}
+
+void BoidSet::AddBoid(unsigned id, unsigned school, const Vector3 & position, const Vector3 & velocity)
+{
+	Boids boid;
+	//reuse a parked boid before creating a new node
+	if (!pool.Empty())
 	{
-		for (int i = 0; i < BoidsGrid[GridX+1][GridZ].Size(); i++)
-		{
-			NeighbourVec.Push(BoidsGrid[GridX + 1][GridZ][i]);
-		}
+		boid = pool.Back();
+		pool.Pop();
 	}
-	if (GridX > 0)
+	else
+		boid.Initialise(pRes_, pScene_, settings_.kinematic);
+	boid.id = id;
+	boid.school = school;
+	boid.correction = Vector3::ZERO;
+	boid.Spawn(position, velocity);
+	boidList.Push(boid);
+
+	//kinematic boids keep their state between steps, so it is seeded here
+	unsigned index = state.Size();
+	state.Resize(index + 1);
+	SetBoidState(index, position, velocity);
+	state.fx[index] = state.fy[index] = state.fz[index] = 0.0f;
+
+	if (id >= indexOfId.Size())
 	{
-		for (int i = 0; i < BoidsGrid[GridX - 1][GridZ].Size(); i++)
-		{
-			NeighbourVec.Push(BoidsGrid[GridX - 1][GridZ][i]);
-		}
+		unsigned oldSize = indexOfId.Size();
+		indexOfId.Resize(id + 1);
+		for (unsigned i = oldSize; i < indexOfId.Size(); i++)
+			indexOfId[i] = -1;
 	}
-	if (GridZ < 19)
+	indexOfId[id] = index;
+	indexValid_ = false;
+}
+
+void BoidSet::SetBoidState(unsigned index, const Vector3 & position, const Vector3 & velocity)
+{
+	state.px[index] = position.x_;
+	state.py[index] = position.y_;
+	state.pz[index] = position.z_;
+	state.vx[index] = velocity.x_;
+	state.vy[index] = velocity.y_;
+	state.vz[index] = velocity.z_;
+	indexValid_ = false;
+}
+
+void BoidSet::DespawnSchool(unsigned school)
+{
+	//walk backwards so the boid swapped into slot i has already been checked
+	for (unsigned i = boidList.Size(); i-- > 0;)
 	{
-		for (int i = 0; i < BoidsGrid[GridX][GridZ + 1].Size(); i++)
-		{
-			NeighbourVec.Push(BoidsGrid[GridX][GridZ + 1][i]);
-		}
+		if (boidList[i].school == school)
+			Despawn(i);
 	}
-	if (GridZ > 0)
+	schools.Remove(school);
+}
+
+void BoidSet::Despawn(unsigned index)
+{
+	if (settings_.recordEvents)
 	{
-		for (int i = 0; i < BoidsGrid[GridX][GridZ - 1].Size(); i++)
-		{
-			NeighbourVec.Push(BoidsGrid[GridX][GridZ - 1][i]);
-		}
+		FlockEvent event;
+		event.type = FLOCK_EVENT_DESPAWN;
+		event.tick = tick;
+		event.id = boidList[index].id;
+		events.Push(event);
 	}
-	//diagonals 
-	if (GridX < 19 && GridZ < 19)
+	indexOfId[boidList[index].id] = -1;
+	boidList[index].Despawn();
+	pool.Push(boidList[index]);
+	unsigned last = boidList.Size() - 1;
+	boidList[index] = boidList[last];
+	boidList.Pop();
+	state.RemoveSwap(index);
+	if (index < last)
+		indexOfId[boidList[index].id] = index;
+	indexValid_ = false;
+}
+
+void BoidSet::Clear()
+{
+	for (unsigned i = 0; i < boidList.Size(); i++)
+		boidList[i].pNode->Remove();
+	for (unsigned i = 0; i < pool.Size(); i++)
+		pool[i].pNode->Remove();
+	boidList.Clear();
+	pool.Clear();
+	schools.Clear();
+	events.Clear();
+	respawns.Clear();
+	indexOfId.Clear();
+	state.Resize(0);
+	indexValid_ = false;
+}
+
+//WorkQueue entry point, start_ and end_ carry the boid range and aux_ the set
+static void ComputeForcesWork(const WorkItem* item, unsigned /*threadIndex*/)
+{
+	BoidSet* set = reinterpret_cast<BoidSet*>(item->aux_);
+	set->ComputeForces((unsigned)(size_t)item->start_, (unsigned)(size_t)item->end_);
+}
+
+void BoidSet::ComputeForces(unsigned begin, unsigned end)
+{
+	if (UseVerletLists())
+		ComputeFlockForces(state, *index, verletLists_, params_, begin, end);
+	else
+		ComputeFlockForces(state, *index, params_, begin, end);
+}
+
+void BoidSet::SetIndexType(FlockIndexType type)
+{
+	index = CreateFlockIndex(type, indexSettings_);
+	indexValid_ = false;
+	if (settings_.verletSkin > 0.0f && !index->FiltersRuns())
+		Log::WriteRaw("Flock index " + String(GetFlockIndexName(type)) + " queries as cheaply as it reads Verlet lists, "
+			"ignoring the skin\n");
+}
+
+void BoidSet::Integrate(float timeStep)
+{
+	IntegrateFlock(state, params_, timeStep);
+}
+
+void BoidSet::QuerySphere(const Vector3 & centre, float radius, std::vector<unsigned>& result) const
+{
+	if (indexValid_)
+		QueryFlockSphere(state, *index, centre.x_, centre.y_, centre.z_, radius, result);
+}
+
+void BoidSet::Eat(const PODVector<Vector3>& eaters, float radius, PODVector<FlockMeal>& meals)
+{
+	//query everything first, a despawn invalidates the index and its swap remove moves boids still to be tested
+	std::vector<unsigned> hits;
+	PODVector<unsigned> eaten;
+	//boids already taken by an earlier eater
+	std::vector<bool> isEaten(boidList.Size(), false);
+	for (unsigned i = 0; i < eaters.Size(); i++)
 	{
-		for (int i = 0; i < BoidsGrid[GridX + 1][GridZ + 1].Size(); i++)
+		hits.clear();
+		QuerySphere(eaters[i], radius, hits);
+		for (unsigned j = 0; j < hits.size(); j++)
 		{
-			NeighbourVec.Push(BoidsGrid[GridX + 1][GridZ + 1][i]);
+			if (isEaten[hits[j]])
+				continue;
+			isEaten[hits[j]] = true;
+			eaten.Push(hits[j]);
+			FlockMeal meal;
+			meal.eater = i;
+			meal.id = boidList[hits[j]].id;
+			meals.Push(meal);
 		}
 	}
-	if (GridX < 19 && GridZ > 0)
+	//from the highest index down so the swap remove never moves a boid still to be despawned
+	Sort(eaten.Begin(), eaten.End());
+	for (unsigned i = eaten.Size(); i-- > 0;)
 	{
-		for (int i = 0; i < BoidsGrid[GridX + 1][GridZ - 1].Size(); i++)
+		if (settings_.respawnTicks > 0)
 		{
-			NeighbourVec.Push(BoidsGrid[GridX + 1][GridZ - 1][i]);
+			FlockRespawn respawn;
+			respawn.tick = tick + settings_.respawnTicks;
+			respawn.school = boidList[eaten[i]].school;
+			respawns.Push(respawn);
 		}
+		Despawn(eaten[i]);
 	}
-	if (GridX > 0 && GridZ < 19)
+	numEaten += eaten.Size();
+}
+
+void BoidSet::Update(float Num, TickProfile* profile)
+{
+	//bring back the eaten boids that are due on parked nodes, before the step so they steer in it.
+	//Their school may have been despawned in the meantime
+	if (!respawns.Empty() && respawns.Front().tick <= tick)
 	{
-		for (int i = 0; i < BoidsGrid[GridX - 1][GridZ + 1].Size(); i++)
+		URHO3D_PROFILE(RespawnBoids);
+		PhaseTimer timer(profile, PHASE_RESPAWN);
+		unsigned due = 0;
+		while (due < respawns.Size() && respawns[due].tick <= tick)
 		{
-			NeighbourVec.Push(BoidsGrid[GridX - 1][GridZ + 1][i]);
+			unsigned school = respawns[due++].school;
+			if (!schools.Contains(school))
+				continue;
+			unsigned id = pool.Empty() ? nextId++ : pool.Back().id;
+			SpawnBoid(id, school, Vector3(0.0f, BOID_SPAWN_Y, 0.0f), 90.0f);
+			numRespawned++;
 		}
+		respawns.Erase(0, due);
 	}
-	if (GridX > 0 && GridZ > 0)
+
+	//single read of the rigid bodies, everything below works on the flock state
+	if (!settings_.kinematic)
 	{
-		for (int i = 0; i < BoidsGrid[GridX - 1][GridZ - 1].Size(); i++)
+		URHO3D_PROFILE(ReadBoids);
+		PhaseTimer timer(profile, PHASE_READSTATE);
+		for (unsigned i = 0; i < boidList.Size(); i++)
 		{
-			NeighbourVec.Push(BoidsGrid[GridX - 1][GridZ - 1][i]);
+			boidList[i].ReadState(state, i);
 		}
 	}
 
-}
-
-
-
-
-void BoidSet::Initialise(ResourceCache * pRes, Scene * pScene)
-{
-	
-
-	for (int x = 0; x < 20; x++)
 	{
-	
-		BoidsGrid.Push(Vector<Vector<int>>());
-		for (int y = 0; y < 20; y++)
+		URHO3D_PROFILE(GridBoids);
+		PhaseTimer timer(profile, PHASE_GRIDBOIDS);
+		//the same state gives the same pick, so a client running the flock switches on the same step as the server
+		if (settings_.indexType == FLOCK_INDEX_AUTO && tick % FLOCK_INDEX_CHOOSE_TICKS == 0)
 		{
-			
-			BoidsGrid[x].Push(Vector<int>());
-			
+			FlockIndexType type = ChooseFlockIndex(state, indexSettings_, settings_.maxNeighbours);
+			if (type != index->GetType())
+				SetIndexType(type);
 		}
-
-	}
-
-	for (int x = 0; x < Numboids; x++)
-	{
-		boidList[x].Initialise(pRes,pScene);
-	
+		//with a Verlet skin the index is only refreshed in place until some boid has drifted half the skin
+		bool rebuild = !indexValid_ || !UseVerletLists();
+		if (!rebuild)
+		{
+			index->Refresh(state);
+			rebuild = index->GetDrift() > verletLists_.GetRebuildDrift();
+		}
+		if (rebuild)
+		{
+			index->Build(state);
+			verletLists_.Invalidate(state.Size());
+		}
+		indexValid_ = true;
 	}
-
 	
-
-	
-}
-
-void BoidSet::Update(float Num)
-{
-
-	GridBoids(boidList);
-	
-	for (int i = 0; i < Numboids; i++)
+	//read phase: every force depends only on the index snapshot and writes only its own slot,
+	//so the result is the same however the boids are split between threads.
+	//The neighbour search streams straight into the forces, so the two are one block
 	{
-		boidList[i].FindNeighbours(boidList);
-		boidList[i].ComputeForce(boidList);
-		boidList[i].Update(Num);
+		URHO3D_PROFILE(ComputeForce);
+		PhaseTimer timer(profile, PHASE_COMPUTEFORCE);
+		unsigned numBoids = boidList.Size();
+		unsigned chunkSize = settings_.chunkSize;
+		if (workQueue_ && chunkSize > 0 && numBoids > chunkSize)
+		{
+			for (unsigned begin = 0; begin < numBoids; begin += chunkSize)
+			{
+				SharedPtr<WorkItem> item = workQueue_->GetFreeItem();
+				item->priority_ = M_MAX_UNSIGNED;
+				item->workFunction_ = ComputeForcesWork;
+				item->start_ = (void*)(size_t)begin;
+				item->end_ = (void*)(size_t)Min(begin + chunkSize, numBoids);
+				item->aux_ = this;
+				workQueue_->AddWorkItem(item);
+			}
+			//the main thread helps out until the force phase is done
+			workQueue_->Complete(M_MAX_UNSIGNED);
+		}
+		else
+		{
+			ComputeForces(0, numBoids);
+		}
 	}
-	
-	ClearGrid();
-}
 
-void BoidSet::GridBoids(Boids * boid)
-{
-	for (int i = 0; i < Numboids; i++)
+	//write phase: single pass back to the rigid bodies or node transforms on the main thread
+	if (settings_.kinematic)
 	{
-		//get the position of the current boid
-		Vector3 Pos = boid[i].pRigidBody->GetPosition();
-		//plus 100 to make all values positive
-		int x = Pos.x_ + 100;
-		int z = Pos.z_ + 100;
-		//divide by 20 to get grid position
-		int GridX = x / 10;
-		int GridZ = z / 10;
-		if (GridZ > 19 || GridX > 19 || GridX < 0 || GridZ < 0)
 		{
-
-		
-			continue;
+			URHO3D_PROFILE(IntegrateBoids);
+			PhaseTimer timer(profile, PHASE_INTEGRATE);
+			Integrate(Num);
+		}
+		URHO3D_PROFILE(WriteBoids);
+		PhaseTimer timer(profile, PHASE_WRITEBACK);
+		for (unsigned i = 0; i < boidList.Size(); i++)
+		{
+			boidList[i].WriteTransform(state, i);
 		}
-		BoidsGrid[GridX][GridZ].Push(i);
 	}
-}
-
-void BoidSet::ClearGrid()
-{
-	for (int x = 0; x < 20; x++)
+	else
 	{
-		for (int y = 0; y < 20; y++)
+		URHO3D_PROFILE(WriteBoids);
+		PhaseTimer timer(profile, PHASE_WRITEBACK);
+		for (unsigned i = 0; i < boidList.Size(); i++)
 		{
-			for (int z = 0; z < BoidsGrid[x][y].Size(); z++)
-			{
-				BoidsGrid[x][y].Clear();
-			}
+			boidList[i].Update(state, i);
 		}
-
 	}
+	tick++;
 }
-
-
-
-
-
-
@@ -1,26 +1,24 @@
 #pragma once
 
-#include <Urho3D/Engine/Application.h>
-#include <Urho3D/Input/Input.h>
-#include <Urho3D/Core/ProcessUtils.h>
-#include <Urho3D/Engine/Engine.h>
-#include <Urho3D/Graphics/AnimatedModel.h>
-#include <Urho3D/Graphics/AnimationController.h>
-#include <Urho3D/Graphics/Camera.h>
-#include <Urho3D/Graphics/Light.h>
-#include <Urho3D/Graphics/Material.h>
-#include <Urho3D/Graphics/Octree.h>
-#include <Urho3D/Graphics/Renderer.h>
-#include <Urho3D/Graphics/Zone.h>
-#include <Urho3D/Input/Controls.h>
-#include <Urho3D/Input/Input.h>
-#include <Urho3D/IO/FileSystem.h>
-#include <Urho3D/Physics/CollisionShape.h>
-#include <Urho3D/Physics/PhysicsWorld.h>
-#include <Urho3D/Physics/RigidBody.h>
-#include <Urho3D/Resource/ResourceCache.h>
-#include <Urho3D/Scene/Scene.h>
-static const int Numboids = 200;
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "FlockCore/FlockIndex.h"
+#include "FlockCore/FlockRules.h"
+#include "FlockCore/FlockState.h"
+#include "FlockCore/FlockVerlet.h"
+
+//flock size used when none is given with -boids on the command line
+static const unsigned DEFAULT_NUM_BOIDS = 200;
+//depth the starting and respawned schools are centred on, the middle of the water column
+static const float BOID_SPAWN_Y = 0.5f * (BOID_MIN_Y + BOID_MAX_Y);
+//flock steps between measurements of the flock when the spatial index backend is picked automatically
+static const unsigned FLOCK_INDEX_CHOOSE_TICKS = 60;
+//collision layer of fish rigid bodies. Their mask leaves out the player cones' layer, eating is a spatial index query
+static const unsigned BOID_COLLISION_LAYER = 1;
+static const unsigned PLAYER_COLLISION_LAYER = 4;
 
 namespace Urho3D
 {
@@ -29,50 +27,227 @@ namespace Urho3D
 	class RigidBody;
 	class CollisionShape;
 	class ResourceCache;
+	class StaticModel;
+	class WorkQueue;
 }
 // All Urho3D classes reside in namespace Urho3D
 using namespace Urho3D;
 
-class Boids
+class TickProfile;
+
+/// Startup parameters of a BoidSet, filled from the engine parameters.
+struct FlockSettings
 {
-	static float Range_FAttract;
-	static float Range_FRepel;
-	static float Range_FAlign;
-	static float FAttract_Factor;
-	static float FRepel_Factor;
-	static float FAlign_Factor;
-	static float FAttract_Vmax;
+	FlockSettings() :
+		numBoids(DEFAULT_NUM_BOIDS),
+		indexType(FLOCK_INDEX_AUTO),
+		cellSize(10.0f),
+		minX(-100.0f),
+		minZ(-100.0f),
+		maxX(100.0f),
+		maxZ(100.0f),
+		maxNeighbours(0),
+		verletSkin(0.0f),
+		incrementalGrid(true),
+		chunkSize(512),
+		useSimd(true),
+		farField(true),
+		kinematic(false),
+		recordEvents(false),
+		seed(0),
+		respawnTicks(0)
+	{
+	}
+
+	//number of boids in the first school
+	unsigned numBoids;
+	//spatial index backend, FLOCK_INDEX_AUTO picks one from the spread and crowding of the flock every few steps
+	FlockIndexType indexType;
+	//grid cell size, also the radius of each boid's neighbour query, and the extents of the uniform grid
+	float cellSize;
+	float minX, minZ;
+	float maxX, maxZ;
+	//only the closest maxNeighbours boids steer each boid, 0 uses every boid in range
+	unsigned maxNeighbours;
+	//Verlet skin: neighbour runs are gathered this much wider and reused, and the index only rebuilt, once some boid
+	//has moved half of it. 0 rebuilds and gathers every step, the grid backends ignore it
+	float verletSkin;
+	//the uniform grid only moves the boids that changed cell instead of sorting every boid again
+	bool incrementalGrid;
+	//boids per WorkQueue item in the force phase, 0 computes every force on the main thread
+	unsigned chunkSize;
+	//use the SSE steering kernel when the engine is built with URHO3D_SSE
+	bool useSimd;
+	//cohesion reaches past the neighbour query through the aggregates of far cells or tree nodes
+	bool farField;
+	//integrate boids on the flock state and only write node transforms, no rigid bodies are created
+	bool kinematic;
+	//journal every spawn and despawn so clients running their own copy of the flock can replay them
+	bool recordEvents;
+	//spawn positions are hashed from the seed, the boid id and the tick
+	unsigned seed;
+	//steps after being eaten that a boid comes back, 0 leaves eaten boids in the pool
+	unsigned respawnTicks;
+};
 
+enum FlockEventType
+{
+	FLOCK_EVENT_SPAWN = 0,
+	FLOCK_EVENT_DESPAWN
+};
+
+/// A spawn or despawn in the order the server made it. tick is the number of flock steps taken before it.
+struct FlockEvent
+{
+	FlockEventType type;
+	unsigned tick;
+	unsigned id;
+	//spawn only
+	unsigned school;
+	Vector3 centre;
+	float spread;
+};
+
+/// An eaten boid waiting to come back. Only the school is kept, the boid is rebuilt from the pool when it is due.
+struct FlockRespawn
+{
+	unsigned tick;
+	unsigned school;
+};
+
+/// A fish caught in BoidSet::Eat.
+struct FlockMeal
+{
+	//index of the eater in the list given to Eat
+	unsigned eater;
+	//id of the fish, its boidList slot has been reused by the time the list is read
+	unsigned id;
+};
+
+/// Engine side of one boid: its node and components. The simulation itself is the FlockCore library, run by BoidSet
+/// on the flock state.
+class Boids
+{
 public:
 	Node* pNode;
 	RigidBody* pRigidBody;
 	CollisionShape* pCollsionShape;
 	StaticModel* pObject;
-	Vector3 Force;
-	Vector<int> NeighbourVec; 
+	//stable identifier, kept while the boid moves around boidList or sits in the pool
+	unsigned id;
+	unsigned school;
 
 	Boids();
 	~Boids();
 	
-	void Initialise(ResourceCache* pRes, Scene* pScene);
-	void ComputeForce(Boids* boid);
-	void Update(float Num);
-	void FindNeighbours(Boids* boid);
+	//create the node and components, the boid starts disabled. kinematic boids get no rigid body
+	void Initialise(ResourceCache* pRes, Scene* pScene, bool kinematic);
+	//enable the boid at a position, used for both new and pooled boids
+	void Spawn(const Vector3& position, const Vector3& velocity);
+	//disable the node so it costs no physics or rendering while parked in the pool
+	void Despawn();
+	//copy the rigid body position and velocity into slot index of the flock state
+	void ReadState(FlockState& state, int index) const;
+	//write the computed force back to the rigid body
+	void Update(const FlockState& state, int index);
+	//kinematic mode: write the integrated position and heading to the node
+	void WriteTransform(const FlockState& state, int index);
+	//orientation of a cone swimming along vel
+	static Quaternion HeadingRotation(const Vector3& vel);
+
+	//kinematic mode: visual offset from a correction of the state, shrinks every step
+	Vector3 correction;
 	
 };
 
 class BoidSet
 {
 public:
-	Boids boidList[Numboids];
+	//active boids, packed so that boidList[i] owns slot i of the flock state
+	Vector<Boids> boidList;
+	FlockState state;
+	//spatial index over the state, rebuilt every Update, or refreshed while the Verlet lists hold
+	std::unique_ptr<FlockIndex> index;
+	//ids of the schools currently swimming, oldest first
+	PODVector<unsigned> schools;
 	
-	//Vector<Vector<Vector<int>>> BoidsGrid;
-	BoidSet() {};
+	BoidSet();
 
-	void Initialise(ResourceCache* pRes, Scene* pScene);
-	void Update(float Num);
-	void GridBoids(Boids* boid);
-	void ClearGrid();
+	//create the spatial index, reserve room for the first school and spawn it
+	void Initialise(ResourceCache* pRes, Scene* pScene, const FlockSettings& settings);
+	//spawn count boids within spread of centre and return the new school id
+	unsigned SpawnSchool(unsigned count, const Vector3& centre, float spread);
+	//spawn one boid within spread of centre. The same seed, id and tick always give the same position and velocity
+	void SpawnBoid(unsigned id, unsigned school, const Vector3& centre, float spread);
+	//append a boid with a given state, a parked node is reused when there is one
+	void AddBoid(unsigned id, unsigned school, const Vector3& position, const Vector3& velocity);
+	//remove every boid of a school, their nodes are parked in the pool for reuse
+	void DespawnSchool(unsigned school);
+	unsigned GetNumBoids() const { return boidList.Size(); }
+	//eaten boids waiting to respawn
+	unsigned GetNumRespawns() const { return respawns.Size(); }
+	//boids eaten and brought back since the start, for the server metrics
+	unsigned GetNumEaten() const { return numEaten; }
+	unsigned GetNumRespawned() const { return numRespawned; }
+	//read phase: compute the forces of boids [begin, end) from the index snapshot, safe to run on any thread
+	void ComputeForces(unsigned begin, unsigned end);
+	//kinematic mode: semi-implicit Euler step of the flock state
+	void Integrate(float timeStep);
+	//append the index of every boid within radius of centre, candidates come from the spatial index.
+	//finds nothing between a spawn or despawn and the next Update, when the indexed slots are out of date
+	void QuerySphere(const Vector3& centre, float radius, std::vector<unsigned>& result) const;
+	//swap remove of an active boid into the pool, the boid last in boidList takes over index
+	void Despawn(unsigned index);
+	//despawn every boid within radius of an eater and append a meal for each. A fish in reach of two eaters goes to
+	//the first in the list, and comes back settings.respawnTicks later. Only finds boids after an Update, like QuerySphere
+	void Eat(const PODVector<Vector3>& eaters, float radius, PODVector<FlockMeal>& meals);
+	//remove every boid and its node from the scene
+	void Clear();
+	//return the boidList index of a boid id, or -1 when it is not active
+	int GetIndex(unsigned id) const { return id < indexOfId.Size() ? indexOfId[id] : -1; }
+	//overwrite the state of an active boid, the node is written on the next Update
+	void SetBoidState(unsigned index, const Vector3& position, const Vector3& velocity);
+	//flock steps taken so far
+	unsigned GetTick() const { return tick; }
+	void SetTick(unsigned value) { tick = value; }
+	const FlockSettings& GetSettings() const { return settings_; }
+	//backend the index runs on now, never FLOCK_INDEX_AUTO
+	FlockIndexType GetIndexType() const { return index->GetType(); }
+	//switch the index to a backend, auto mode may switch again on its next measurement
+	void SetIndexType(FlockIndexType type);
+	//spawns and despawns since the journal was last cleared, when settings.recordEvents is on
+	PODVector<FlockEvent> events;
+	bool IsKinematic() const { return settings_.kinematic; }
+	//box every boid is kept inside, the tank extents across and BOID_MIN_Y to BOID_MAX_Y up
+	BoundingBox GetBounds() const;
+	//one flock step. With a profile, each stage is timed into its tick phase as well as the Urho3D profiler
+	void Update(float Num, TickProfile* profile = nullptr);
 	
+private:
+	ResourceCache* pRes_;
+	Scene* pScene_;
+	WorkQueue* workQueue_;
+	FlockSettings settings_;
+	//steering and integrator tunables handed to the flock core, built from settings_
+	FlockParams params_;
+	//cell size, extents and leaf size handed to every index backend
+	FlockIndexSettings indexSettings_;
+	//false once boids have been added or removed since the index was built
+	bool indexValid_;
+	//neighbour runs of every boid reused between index builds, when settings_.verletSkin is on
+	FlockVerletLists verletLists_;
+	//a skin is set and the index backend reads the lists, the grids query again as cheaply
+	bool UseVerletLists() const { return settings_.verletSkin > 0.0f && index->FiltersRuns(); }
+	//despawned boids that keep their node and components for the next spawn
+	Vector<Boids> pool;
+	unsigned nextSchool;
+	unsigned nextId;
+	unsigned tick;
+	//boidList index of every id ever used, -1 while pooled
+	PODVector<int> indexOfId;
+	//in tick order, every eaten boid waits the same number of steps
+	PODVector<FlockRespawn> respawns;
+	unsigned numEaten;
+	unsigned numRespawned;
 
 };
\ No newline at end of file
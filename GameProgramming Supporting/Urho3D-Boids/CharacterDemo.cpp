@@ -57,6 +57,10 @@
 #include <Urho3D/Graphics/Skybox.h>
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Engine/DebugHud.h>
+#include <Urho3D/IO/File.h>
 
 
 
@@ -64,25 +68,53 @@
 #include "CharacterDemo.h"
 #include "Touch.h"
 #include "Boids.h"
+#include "FlockNet.h"
+#include "FlockSync.h"
 
 #include <Urho3D/DebugNew.h>
 
 URHO3D_DEFINE_APPLICATION_MAIN(CharacterDemo)
 
 BoidSet boidset;
+FlockSnapshotWriter flockWriter;
+FlockReplica flockReplica;
+FlockSyncServer flockSyncServer;
+FlockSyncClient flockSyncClient;
 int score;
 
 static const StringHash E_CLIENTOBJECTAUTHORITY("ClientObjectAuthority");
 // Identifier for the node ID parameter in the event data
 static const StringHash PLAYER_ID("IDENTITY");
+// Server tick rate in the same event, the client steps its physics and makes its inputs at it too
+static const StringHash TICK_RATE("TICKRATE");
 // Custom event on server, client has pressed button that it wants to start game
 static const StringHash E_CLIENTISREADY("ClientReadyToStart");
+// Name of the replicated player cones, the client renders these from snapshot buffers
+static const StringHash PLAYER_CONE_NAME("AClientClone");
+// Distance from a player cone at which a fish is eaten
+static const float EAT_RADIUS = 2.0f;
+// Fog of the client scene, fish past its end are hidden and the server leaves them out of that client's snapshots
+static const float CLIENT_FOG_START = 100.0f;
+static const float CLIENT_FOG_END = 200.0f;
+// Seconds an eaten fish stays in the pool before it swims back in
+static const float DEFAULT_RESPAWN_DELAY = 5.0f;
+// Upper bounds in seconds of the tick and flock update histograms, the last two are past a 60 Hz tick budget
+static const float TICK_BUCKETS[] = { 0.0005f, 0.001f, 0.002f, 0.004f, 0.008f, 0.016f, 0.033f, 0.066f };
+static const unsigned NUM_TICK_BUCKETS = sizeof(TICK_BUCKETS) / sizeof(TICK_BUCKETS[0]);
 
 
 
 CharacterDemo::CharacterDemo(Context* context) :
     Sample(context),
-    firstPerson_(false)
+    firstPerson_(false),
+    headless_(false),
+    bot_(false),
+    reportTimer_(0.0f),
+    profileTimer_(0.0f),
+    tickSeconds_(TICK_BUCKETS, NUM_TICK_BUCKETS),
+    flockStepSeconds_(TICK_BUCKETS, NUM_TICK_BUCKETS),
+    ticks_(0),
+    metricsFileTimer_(0.0f)
 {
 	//TUTORIAL: TODO
 }
@@ -91,11 +123,141 @@ CharacterDemo::~CharacterDemo()
 {
 }
 
+void CharacterDemo::Setup()
+{
+	Sample::Setup();
+	//number of boids the server starts with, -boids <count> overrides the default
+	if (!engineParameters_.Contains("Boids"))
+		engineParameters_["Boids"] = DEFAULT_NUM_BOIDS;
+	//flock grid cell size and neighbour query radius, -cellsize <units> overrides the default
+	if (!engineParameters_.Contains("FlockCellSize"))
+		engineParameters_["FlockCellSize"] = FlockSettings().cellSize;
+	//spatial index backend of the flock, -flockindex <auto|grid|hashed|kdtree|octree> overrides the default
+	if (!engineParameters_.Contains("FlockIndex"))
+		engineParameters_["FlockIndex"] = GetFlockIndexName(FlockSettings().indexType);
+	//cap on neighbours per boid, -maxneighbours <k> overrides the default of no cap
+	if (!engineParameters_.Contains("FlockMaxNeighbours"))
+		engineParameters_["FlockMaxNeighbours"] = FlockSettings().maxNeighbours;
+	//Verlet skin of the flock neighbour lists, -flockskin <units> reuses them over several steps
+	if (!engineParameters_.Contains("FlockSkin"))
+		engineParameters_["FlockSkin"] = FlockSettings().verletSkin;
+	//boids per worker thread job, -flockchunk 0 keeps the flock on the main thread
+	if (!engineParameters_.Contains("FlockChunkSize"))
+		engineParameters_["FlockChunkSize"] = FlockSettings().chunkSize;
+	//fixed simulation rate for physics, flock and client controls, -tickrate <hz> overrides the default
+	if (!engineParameters_.Contains("TickRate"))
+		engineParameters_["TickRate"] = DEFAULT_TICK_RATE;
+	//rate the server sends updates to clients, -netfps <hz> overrides the default
+	if (!engineParameters_.Contains("NetworkFps"))
+		engineParameters_["NetworkFps"] = DEFAULT_NETWORK_FPS;
+	//how far behind the server clients render fish and players, -interpdelay <seconds> overrides the default
+	if (!engineParameters_.Contains("InterpolationDelay"))
+		engineParameters_["InterpolationDelay"] = DEFAULT_INTERPOLATION_DELAY;
+	//how long eaten fish take to come back, -respawndelay 0 keeps them eaten
+	if (!engineParameters_.Contains("FishRespawnDelay"))
+		engineParameters_["FishRespawnDelay"] = DEFAULT_RESPAWN_DELAY;
+	//server a bot joins, -connect <address> overrides the default
+	if (!engineParameters_.Contains("ServerAddress"))
+		engineParameters_["ServerAddress"] = "localhost";
+	//seconds between load reports of a headless server or bot, -loadreport 0 turns them off
+	if (!engineParameters_.Contains("LoadReportInterval"))
+		engineParameters_["LoadReportInterval"] = 0.0f;
+	//seconds between tick phase timing logs of a headless server, -profilelog 0 turns them off
+	if (!engineParameters_.Contains("ProfileLogInterval"))
+		engineParameters_["ProfileLogInterval"] = DEFAULT_PROFILE_LOG_INTERVAL;
+	//local port of the server's metrics page, -metricsport <port> turns it on
+	if (!engineParameters_.Contains("MetricsPort"))
+		engineParameters_["MetricsPort"] = 0;
+	//file the server rewrites with the metrics page every second, -metricsfile <path> turns it on
+	if (!engineParameters_.Contains("MetricsFile"))
+		engineParameters_["MetricsFile"] = String::EMPTY;
+	const Vector<String>& arguments = GetArguments();
+	for (unsigned i = 0; i + 1 < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		if (argument == "-boids")
+			engineParameters_["Boids"] = ToUInt(arguments[i + 1]);
+		else if (argument == "-cellsize")
+			engineParameters_["FlockCellSize"] = ToFloat(arguments[i + 1]);
+		else if (argument == "-flockindex")
+			engineParameters_["FlockIndex"] = arguments[i + 1].ToLower();
+		else if (argument == "-maxneighbours")
+			engineParameters_["FlockMaxNeighbours"] = ToUInt(arguments[i + 1]);
+		else if (argument == "-flockskin")
+			engineParameters_["FlockSkin"] = Max(ToFloat(arguments[i + 1]), 0.0f);
+		else if (argument == "-flockchunk")
+			engineParameters_["FlockChunkSize"] = ToUInt(arguments[i + 1]);
+		else if (argument == "-tickrate")
+			engineParameters_["TickRate"] = Max(ToInt(arguments[i + 1]), 1);
+		else if (argument == "-netfps")
+			engineParameters_["NetworkFps"] = Max(ToInt(arguments[i + 1]), 1);
+		else if (argument == "-interpdelay")
+			engineParameters_["InterpolationDelay"] = Max(ToFloat(arguments[i + 1]), 0.0f);
+		else if (argument == "-respawndelay")
+			engineParameters_["FishRespawnDelay"] = Max(ToFloat(arguments[i + 1]), 0.0f);
+		else if (argument == "-connect")
+			engineParameters_["ServerAddress"] = arguments[i + 1];
+		else if (argument == "-loadreport")
+			engineParameters_["LoadReportInterval"] = Max(ToFloat(arguments[i + 1]), 0.0f);
+		else if (argument == "-profilelog")
+			engineParameters_["ProfileLogInterval"] = Max(ToFloat(arguments[i + 1]), 0.0f);
+		else if (argument == "-metricsport")
+			engineParameters_["MetricsPort"] = Clamp(ToInt(arguments[i + 1]), 0, 65535);
+		else if (argument == "-metricsfile")
+			engineParameters_["MetricsFile"] = arguments[i + 1];
+	}
+	//scalar steering kernel for comparison runs
+	if (!engineParameters_.Contains("FlockSimd"))
+		engineParameters_["FlockSimd"] = !arguments.Contains("-nosimd");
+	//cohesion only from the fish inside the neighbour query, for comparison runs
+	if (!engineParameters_.Contains("FlockFarField"))
+		engineParameters_["FlockFarField"] = !arguments.Contains("-nofarfield");
+	//uniform grid sorted from scratch every step, for comparison runs
+	if (!engineParameters_.Contains("FlockIncrementalGrid"))
+		engineParameters_["FlockIncrementalGrid"] = !arguments.Contains("-noincremental");
+	//fish integrated by the flock instead of Bullet
+	if (!engineParameters_.Contains("FlockKinematic"))
+		engineParameters_["FlockKinematic"] = arguments.Contains("-kinematic");
+	//clients run the flock themselves from the server's spawns and despawns, needs the deterministic kinematic flock
+	if (!engineParameters_.Contains("FlockClientSim"))
+		engineParameters_["FlockClientSim"] = arguments.Contains("-clientflock");
+	//between rebuilds a Verlet index still groups fish by where they were at the last build, which a client starting
+	//from a keyframe cannot know, so client simulated flocks build the index every step
+	if (engineParameters_["FlockClientSim"].GetBool())
+	{
+		engineParameters_["FlockKinematic"] = true;
+		engineParameters_["FlockSkin"] = 0.0f;
+	}
+	//dedicated server, Sample::Setup always asks for a window so put the engine's own -headless flag back
+	if (arguments.Contains("-headless"))
+		engineParameters_["Headless"] = true;
+	//load test client, headless too and without a log file so many can run side by side
+	if (!engineParameters_.Contains("LoadTestBot"))
+		engineParameters_["LoadTestBot"] = arguments.Contains("-bot");
+	if (engineParameters_["LoadTestBot"].GetBool())
+	{
+		engineParameters_["Headless"] = true;
+		engineParameters_["LogName"] = String::EMPTY;
+	}
+}
+
 void CharacterDemo::Start()
 {
 	
 	score = 0;
 	OpenConsoleWindow();
+	headless_ = engine_->IsHeadless();
+	bot_ = headless_ && engineParameters_["LoadTestBot"].GetBool();
+	if (bot_)
+	{
+		StartBot();
+		return;
+	}
+	if (headless_)
+	{
+		StartHeadlessServer();
+		return;
+	}
     // Execute base class startup
     Sample::Start();
     if (touchEnabled_)
@@ -127,14 +289,6 @@ void CharacterDemo::CreateServerScene()
 	scene_->CreateComponent<Octree>(LOCAL);
 	scene_->CreateComponent<PhysicsWorld>(LOCAL);
 	
-	//Create camera node and component
-	//cameraNode_ = new Node(context_);
-	Camera* camera = cameraNode_->CreateComponent<Camera>(LOCAL);
-	cameraNode_->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
-	camera->SetFarClip(300.0f);
-
-	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_,scene_, camera));
-
 	// Create static scene content. First create a zone for ambient lighting and fog control
 		Node* zoneNode = scene_->CreateChild("Zone");
 	Zone* zone = zoneNode->CreateComponent<Zone>();
@@ -143,17 +297,8 @@ void CharacterDemo::CreateServerScene()
 	zone->SetFogStart(100.0f);
 	zone->SetFogEnd(300.0f);
 	zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
-
-	// Create a directional light with cascaded shadow mapping
-	Node* lightNode = scene_->CreateChild("DirectionalLight",LOCAL);
-	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
-	Light* light = lightNode->CreateComponent<Light>();
-	light->SetLightType(LIGHT_DIRECTIONAL);
-	light->SetCastShadows(true);
-	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
-	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f,
-		0.8f));
-	light->SetSpecularIntensity(0.5f);
+	// Fish past the clients' fog are not sent to them at all
+	flockWriter.SetViewDistance(CLIENT_FOG_END);
 
 	// Create the floor object
 	Node* floorNode = scene_->CreateChild("Floor",LOCAL);
@@ -182,6 +327,63 @@ void CharacterDemo::CreateServerScene()
 	WallList[3]->SetPosition(Vector3(-100.0f, -0.5f, 0.0f));
 	WallList[3]->SetRotation(Quaternion(90.0f, 0.0f, 90.0f));
 
+	//run physics and with it the flock and client controls at a fixed rate
+	scene_->GetComponent<PhysicsWorld>()->SetFps(engineParameters_["TickRate"].GetInt());
+	//clients interpolate, so updates can go out at a lower rate than the simulation
+	GetSubsystem<Network>()->SetUpdateFps(engineParameters_["NetworkFps"].GetInt());
+
+	if (!headless_)
+		CreateServerVisuals();
+
+	FlockSettings flockSettings;
+	flockSettings.numBoids = engineParameters_["Boids"].GetUInt();
+	flockSettings.cellSize = engineParameters_["FlockCellSize"].GetFloat();
+	flockSettings.indexType = ParseFlockIndexType(engineParameters_["FlockIndex"].GetString().CString());
+	if (flockSettings.indexType == MAX_FLOCK_INDEX_TYPES)
+	{
+		Log::WriteRaw("Unknown flock index " + engineParameters_["FlockIndex"].GetString() + ", picking one automatically\n", true);
+		flockSettings.indexType = FLOCK_INDEX_AUTO;
+	}
+	flockSettings.maxNeighbours = engineParameters_["FlockMaxNeighbours"].GetUInt();
+	flockSettings.verletSkin = engineParameters_["FlockSkin"].GetFloat();
+	flockSettings.incrementalGrid = engineParameters_["FlockIncrementalGrid"].GetBool();
+	flockSettings.chunkSize = engineParameters_["FlockChunkSize"].GetUInt();
+	flockSettings.useSimd = engineParameters_["FlockSimd"].GetBool();
+	flockSettings.farField = engineParameters_["FlockFarField"].GetBool();
+	flockSettings.kinematic = engineParameters_["FlockKinematic"].GetBool();
+	flockSettings.recordEvents = engineParameters_["FlockClientSim"].GetBool();
+	flockSettings.seed = Rand();
+	flockSettings.respawnTicks = (unsigned)RoundToInt(engineParameters_["FishRespawnDelay"].GetFloat() * engineParameters_["TickRate"].GetInt());
+	//the uniform grid covers the tank inside the walls, the other backends have no extents
+	flockSettings.minX = flockSettings.minZ = -100.0f;
+	flockSettings.maxX = flockSettings.maxZ = 100.0f;
+	boidset.Initialise(cache, scene_, flockSettings);
+	StartMetrics();
+
+}
+
+void CharacterDemo::CreateServerVisuals()
+{
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+	//Create camera node and component
+	//cameraNode_ = new Node(context_);
+	Camera* camera = cameraNode_->CreateComponent<Camera>(LOCAL);
+	cameraNode_->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
+	camera->SetFarClip(300.0f);
+
+	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_,scene_, camera));
+
+	// Create a directional light with cascaded shadow mapping
+	Node* lightNode = scene_->CreateChild("DirectionalLight",LOCAL);
+	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
+	Light* light = lightNode->CreateComponent<Light>();
+	light->SetLightType(LIGHT_DIRECTIONAL);
+	light->SetCastShadows(true);
+	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
+	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f,
+		0.8f));
+	light->SetSpecularIntensity(0.5f);
+
 	// Create a water plane object that is as large as the terrain
 	Graphics* graphics = GetSubsystem<Graphics>();
 	waterNode_ = scene_->CreateChild("Water",LOCAL);
@@ -236,9 +438,6 @@ void CharacterDemo::CreateServerScene()
 	Skybox* skybox = skyNode->CreateComponent<Skybox>();
 	skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
 	skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
-
-	boidset.Initialise(cache, scene_);
-
 }
 
 void CharacterDemo::CreateClientScene()
@@ -251,34 +450,19 @@ void CharacterDemo::CreateClientScene()
 	scene_->CreateComponent<Octree>(LOCAL);
 	scene_->CreateComponent<PhysicsWorld>(LOCAL);
 
-	//Create camera node and component
+	//Create camera node, a bot has no camera but still tells the server where it is looking from
 	cameraNode_ = new Node(context_);
-	Camera* camera = cameraNode_->CreateComponent<Camera>(LOCAL);
 	cameraNode_->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
-	camera->SetFarClip(300.0f);
-
-	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_, scene_, camera));
 
 	// Create static scene content. First create a zone for ambient lighting and fog control
 	Node* zoneNode = scene_->CreateChild("Zone");
 	Zone* zone = zoneNode->CreateComponent<Zone>();
 	zone->SetAmbientColor(Color(0.15f, 0.15f, 0.15f));
 	zone->SetFogColor(Color(0.5f, 0.5f, 0.7f));
-	zone->SetFogStart(100.0f);
-	zone->SetFogEnd(200.0f);
+	zone->SetFogStart(CLIENT_FOG_START);
+	zone->SetFogEnd(CLIENT_FOG_END);
 	zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
 
-	// Create a directional light with cascaded shadow mapping
-	Node* lightNode = scene_->CreateChild("DirectionalLight", LOCAL);
-	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
-	Light* light = lightNode->CreateComponent<Light>();
-	light->SetLightType(LIGHT_DIRECTIONAL);
-	light->SetCastShadows(true);
-	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
-	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f,
-		0.8f));
-	light->SetSpecularIntensity(0.5f);
-
 	// Create the floor object
 	Node* floorNode = scene_->CreateChild("Floor", LOCAL);
 	floorNode->SetPosition(Vector3(0.0f, -0.5f, 0.0f));
@@ -307,6 +491,40 @@ void CharacterDemo::CreateClientScene()
 	WallList[3]->SetPosition(Vector3(-100.0f, -0.5f, 0.0f));
 	WallList[3]->SetRotation(Quaternion(90.0f, 0.0f, 90.0f));
 
+	if (!headless_)
+		CreateClientVisuals();
+
+	//boidset.Initialise(cache, scene_);
+	//the fish arrive as flock snapshot messages
+	flockReplica.Initialise(cache, scene_);
+	flockReplica.SetDelay(engineParameters_["InterpolationDelay"].GetFloat());
+	//or, with -clientflock on the server, as a keyframe the client then simulates itself
+	flockSyncClient.Initialise(cache, scene_);
+	flockSyncClient.SetDelay(engineParameters_["InterpolationDelay"].GetFloat());
+	coneBuffers_.Clear();
+	conePredictor_.Clear();
+	loadBot_.Clear();
+}
+
+void CharacterDemo::CreateClientVisuals()
+{
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+	Camera* camera = cameraNode_->CreateComponent<Camera>(LOCAL);
+	camera->SetFarClip(300.0f);
+
+	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_, scene_, camera));
+
+	// Create a directional light with cascaded shadow mapping
+	Node* lightNode = scene_->CreateChild("DirectionalLight", LOCAL);
+	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
+	Light* light = lightNode->CreateComponent<Light>();
+	light->SetLightType(LIGHT_DIRECTIONAL);
+	light->SetCastShadows(true);
+	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
+	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f,
+		0.8f));
+	light->SetSpecularIntensity(0.5f);
+
 	// Create a water plane object that is as large as the terrain
 	Graphics* graphics = GetSubsystem<Graphics>();
 	waterNode_ = scene_->CreateChild("Water", LOCAL);
@@ -361,7 +579,6 @@ void CharacterDemo::CreateClientScene()
 	Skybox* skybox = skyNode->CreateComponent<Skybox>();
 	skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
 	skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
-	//boidset.Initialise(cache, scene_);
 }
 
 void CharacterDemo::CreateCharacter()
@@ -383,10 +600,14 @@ void CharacterDemo::SubscribeToEvents()
 	SubscribeToEvent(E_CLIENTCONNECTED, URHO3D_HANDLER(CharacterDemo, HandleClientConnected));
 	SubscribeToEvent(E_CLIENTDISCONNECTED, URHO3D_HANDLER(CharacterDemo, HandleClientDisconnected));
 	SubscribeToEvent(E_PHYSICSPRESTEP, URHO3D_HANDLER(CharacterDemo, HandlePhysicsPreStep));
+	SubscribeToEvent(E_PHYSICSPOSTSTEP, URHO3D_HANDLER(CharacterDemo, HandlePhysicsPostStep));
 	SubscribeToEvent(E_CLIENTISREADY, URHO3D_HANDLER(CharacterDemo, HandleClientToServerReadyToStart));
 	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTISREADY);
 	SubscribeToEvent(E_CLIENTOBJECTAUTHORITY, URHO3D_HANDLER(CharacterDemo, HandleServerToClientObjectID));
 	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTOBJECTAUTHORITY);
+	SubscribeToEvent(E_NETWORKUPDATE, URHO3D_HANDLER(CharacterDemo, HandleNetworkUpdate));
+	SubscribeToEvent(E_NETWORKMESSAGE, URHO3D_HANDLER(CharacterDemo, HandleNetworkMessage));
+	SubscribeToEvent(E_INTERCEPTNETWORKUPDATE, URHO3D_HANDLER(CharacterDemo, HandleInterceptNetworkUpdate));
 
 	
 	
@@ -398,6 +619,14 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 	using namespace Update;
 	// Take the frame time step, which is stored as a float
 	float timeStep = eventData[P_TIMESTEP].GetFloat();
+	UpdateTickProfile(timeStep);
+	UpdateMetrics(timeStep);
+	// Dedicated server and bots have no camera, menu or keyboard
+	if (headless_)
+	{
+		UpdateLoadTest(timeStep);
+		return;
+	}
 	// Do not move if the UI has a focused element (the console)
 	//if (GetSubsystem<UI>()->GetFocusElement()) return;
 	Input* input = GetSubsystem<Input>();
@@ -429,13 +658,24 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 	
 	Network* network = GetSubsystem<Network>();
 	Connection* serverConnection = network->GetServerConnection();
+	//place fish and players from the snapshot buffers before the camera follows our cone
+	if (serverConnection)
+	{
+		URHO3D_PROFILE(UpdateReplicas);
+		float time = GetSubsystem<Time>()->GetElapsedTime();
+		flockReplica.Update(time);
+		flockSyncClient.Update(timeStep);
+		UpdatePlayerCones(time);
+	}
 	//this is local and not on server
 	if (clientObjectID_)
 	{
 		Node* ballNode = this->scene_->GetNode(clientObjectID_);
 		if (ballNode)
 		{
-			
+			// Own cone is drawn where our inputs have already moved it, not where the server last saw it
+			if (conePredictor_.IsActive())
+				ballNode->SetTransform(conePredictor_.GetPosition(), conePredictor_.GetRotation());
 			const float CAMERA_DISTANCE = 3.0f;
 			cameraNode_->SetPosition(ballNode->GetPosition() + cameraNode_->GetRotation()
 				* Vector3::BACK * CAMERA_DISTANCE);
@@ -444,8 +684,6 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 			serverConnection->SetRotation(cameraNode_->GetRotation());*/
 		}
 	}
-	//check collision
-	CheckCollision();
 	
 	
 	if (input->GetKeyPress(KEY_M))
@@ -459,6 +697,26 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 	{
 		FrameInfo frameInfo = GetSubsystem<Renderer>()->GetFrameInfo();
 		Log::WriteRaw("FPS: " + String(1.0 / frameInfo.timeStep_) + "\n");
+		if (network->IsServerRunning())
+		{
+			Log::WriteRaw("Flock update: " + String(flockWriter.GetSize()) + " bytes to " + String(network->GetClientConnections().Size()) + " clients\n");
+			Log::WriteRaw("Boids: " + String(boidset.GetNumBoids()) + ", " + String(boidset.GetNumRespawns()) + " eaten waiting to respawn\n");
+		}
+	}
+	//Server: add or remove a school of fish while running
+	if (network->IsServerRunning())
+	{
+		if (input->GetKeyPress(KEY_KP_PLUS))
+		{
+			boidset.SpawnSchool(50, Vector3(Random(160.0f) - 80.0f, Random(BOID_MIN_Y + 10.0f, BOID_MAX_Y - 10.0f),
+				Random(160.0f) - 80.0f), 10.0f);
+			Log::WriteRaw("Boids: " + String(boidset.GetNumBoids()) + "\n");
+		}
+		if (input->GetKeyPress(KEY_KP_MINUS) && !boidset.schools.Empty())
+		{
+			boidset.DespawnSchool(boidset.schools.Back());
+			Log::WriteRaw("Boids: " + String(boidset.GetNumBoids()) + "\n");
+		}
 	}
 	
 	
@@ -469,6 +727,8 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 void CharacterDemo::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
 {
 	//TUTORIAL: TODO
+	if (headless_)
+		return;
 	UI* ui = GetSubsystem<UI>();
 	ui->GetCursor()->SetVisible(MenuVisable);
 	window_->SetVisible(MenuVisable);
@@ -545,22 +805,246 @@ LineEdit * CharacterDemo::CreateLineEdit(const String & text, int pHeight, Font
 
 void CharacterDemo::CheckCollision()
 {
+	URHO3D_PROFILE(EatFish);
+	PhaseTimer timer(&tickProfile_, PHASE_COLLISION);
 	Network* network = GetSubsystem<Network>();
 	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+	PODVector<Vector3> eaters;
+	PODVector<Node*> eaterNodes;
 	//Server: go through every client connected
 	for (unsigned i = 0; i < connections.Size(); ++i)
 	{
-	
-		Connection* connection = connections[i];
 		// Get the object this connection is controlling
-		Node* ConeNode = serverObjects_[connection];
+		Node* ConeNode = serverObjects_[connections[i]];
 		// Client has no item connected
 		if (!ConeNode) continue;
-		SubscribeToEvent(ConeNode, E_NODECOLLISION, URHO3D_HANDLER(CharacterDemo, HandleNodeCollision));
-		//printf("Id: %i \n", ConeNode->GetID());
+		eaters.Push(ConeNode->GetPosition());
+		eaterNodes.Push(ConeNode);
+	}
+	if (eaters.Empty())
+		return;
+
+	// Every cone eats the fish within EAT_RADIUS, looked up in the flock spatial index
+	PODVector<FlockMeal> meals;
+	boidset.Eat(eaters, EAT_RADIUS, meals);
+	for (unsigned i = 0; i < meals.Size(); ++i)
+	{
+		score++;
+		printf("Client %i 's ", eaterNodes[meals[i].eater]->GetID());
+		printf("Score is: %i \n", score);
 	}
 }
 
+void CharacterDemo::StartHeadlessServer()
+{
+	int tickRate = engineParameters_["TickRate"].GetInt();
+	Log::WriteRaw("(Headless) Dedicated server on port " + String(SERVER_PORT) + " at " + String(tickRate) + " ticks per second\n");
+	// Without a renderer to wait on vsync the main loop would spin, cap it at the tick rate so it sleeps between ticks
+	engine_->SetMaxFps(tickRate);
+	SubscribeToEvents();
+	GetSubsystem<Network>()->StartServer(SERVER_PORT);
+	CreateServerScene();
+	MenuVisable = false;
+}
+
+void CharacterDemo::StartBot()
+{
+	String address = engineParameters_["ServerAddress"].GetString();
+	Log::WriteRaw("(Bot) Load test client joining " + address + ":" + String(SERVER_PORT) + "\n");
+	engine_->SetMaxFps(engineParameters_["TickRate"].GetInt());
+	// Bots started together should not all swim the same way
+	SetRandomSeed(Time::GetSystemTime());
+	SubscribeToEvents();
+	CreateClientScene();
+	GetSubsystem<Network>()->Connect(address, SERVER_PORT, scene_);
+	MenuVisable = false;
+}
+
+void CharacterDemo::UpdateLoadTest(float timeStep)
+{
+	Network* network = GetSubsystem<Network>();
+	Connection* serverConnection = network->GetServerConnection();
+	if (bot_)
+	{
+		// Connection refused or server gone, nothing left to test
+		if (!serverConnection)
+		{
+			Log::WriteRaw("(Bot) Not connected, exiting\n");
+			engine_->Exit();
+			return;
+		}
+		float time = GetSubsystem<Time>()->GetElapsedTime();
+		flockReplica.Update(time);
+		flockSyncClient.Update(timeStep);
+		UpdatePlayerCones(time);
+		// Join as soon as the scene is in, as if the join button was pressed
+		if (!loadBot_.IsJoined() && serverConnection->IsSceneLoaded())
+		{
+			VariantMap remoteEventData;
+			remoteEventData[PLAYER_ID] = 0;
+			serverConnection->SendRemoteEvent(E_CLIENTISREADY, true, remoteEventData);
+			loadBot_.SetJoined(true);
+		}
+		// The camera rides on the cone, the server picks the fish it sends around it
+		if (conePredictor_.IsActive())
+			cameraNode_->SetPosition(conePredictor_.GetPosition());
+	}
+
+	float interval = engineParameters_["LoadReportInterval"].GetFloat();
+	if (interval <= 0.0f)
+		return;
+	reportTimer_ += timeStep;
+	if (reportTimer_ < interval)
+		return;
+	WriteLoadReport();
+	reportTimer_ = 0.0f;
+}
+
+void CharacterDemo::WriteLoadReport()
+{
+	// One line of key=value pairs per report, LoadTest.sh picks these out of the output. Like the tick profile the
+	// figures are rolling, over the last SAMPLE_WINDOW_SIZE samples
+	Network* network = GetSubsystem<Network>();
+	Connection* serverConnection = network->GetServerConnection();
+	String report;
+	if (bot_ && serverConnection)
+	{
+		SampleWindow& latency = loadBot_.GetLatency();
+		report.AppendWithFormat("LOADTEST bot latency_min_ms=%.2f latency_avg_ms=%.2f latency_p50_ms=%.2f latency_p99_ms=%.2f "
+			"latency_max_ms=%.2f bytes_in_per_s=%.0f bytes_out_per_s=%.0f rtt_ms=%.2f", latency.GetMin(), latency.GetAverage(),
+			latency.GetPercentile(0.5f), latency.GetPercentile(0.99f), latency.GetMax(), serverConnection->GetBytesInPerSec(),
+			serverConnection->GetBytesOutPerSec(), serverConnection->GetRoundTripTime() * 1000.0f);
+	}
+	else if (network->IsServerRunning())
+	{
+		const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+		float bytesOut = 0.0f;
+		float bytesIn = 0.0f;
+		for (unsigned i = 0; i < connections.Size(); ++i)
+		{
+			bytesOut += connections[i]->GetBytesOutPerSec();
+			bytesIn += connections[i]->GetBytesInPerSec();
+		}
+		unsigned clients = connections.Size();
+		const SampleWindow& tickTimes = tickProfile_.Get(PHASE_TICK);
+		const SampleWindow& sendTimes = tickProfile_.Get(PHASE_REPLICATION);
+		report.AppendWithFormat("LOADTEST server clients=%u boids=%u tick_min_ms=%.3f tick_avg_ms=%.3f tick_p50_ms=%.3f "
+			"tick_p90_ms=%.3f tick_p99_ms=%.3f tick_max_ms=%.3f send_avg_ms=%.3f send_p99_ms=%.3f "
+			"bytes_out_per_client_per_s=%.0f bytes_in_per_client_per_s=%.0f", clients, boidset.GetNumBoids(), tickTimes.GetMin(),
+			tickTimes.GetAverage(), tickTimes.GetPercentile(0.5f), tickTimes.GetPercentile(0.9f), tickTimes.GetPercentile(0.99f),
+			tickTimes.GetMax(), sendTimes.GetAverage(), sendTimes.GetPercentile(0.99f), clients ? bytesOut / clients : 0.0f,
+			clients ? bytesIn / clients : 0.0f);
+	}
+	if (!report.Empty())
+		Log::WriteRaw(report + "\n");
+}
+
+void CharacterDemo::UpdateTickProfile(float timeStep)
+{
+	if (!GetSubsystem<Network>()->IsServerRunning())
+		return;
+	// Percentiles sort every window, so the HUD refreshes once a second rather than every frame
+	float interval = headless_ ? engineParameters_["ProfileLogInterval"].GetFloat() : 1.0f;
+	if (interval <= 0.0f)
+		return;
+	profileTimer_ += timeStep;
+	if (profileTimer_ < interval)
+		return;
+	profileTimer_ = 0.0f;
+
+	if (headless_)
+	{
+		Log::WriteRaw("(Profile) min/avg/p99 ms " + tickProfile_.ToString() + "\n");
+		return;
+	}
+	DebugHud* debugHud = GetSubsystem<DebugHud>();
+	if (!debugHud)
+		return;
+	for (unsigned i = 0; i < MAX_TICK_PHASES; ++i)
+	{
+		const SampleWindow& window = tickProfile_.Get((TickPhase)i);
+		if (!window.GetSize())
+			continue;
+		String stats;
+		stats.AppendWithFormat("%.3f / %.3f / %.3f ms", window.GetMin(), window.GetAverage(), window.GetPercentile(0.99f));
+		debugHud->SetAppStats(TickProfile::GetPhaseName((TickPhase)i), stats);
+	}
+}
+
+void CharacterDemo::StartMetrics()
+{
+	int port = engineParameters_["MetricsPort"].GetInt();
+	if (!port || metricsEndpoint_.IsRunning())
+		return;
+	if (metricsEndpoint_.Start((unsigned short)port))
+		Log::WriteRaw("(Metrics) Serving http://localhost:" + String(port) + "/metrics\n");
+	else
+		Log::WriteRaw("(Metrics) Could not listen on port " + String(port) + "\n", true);
+}
+
+void CharacterDemo::UpdateMetrics(float timeStep)
+{
+	if (!GetSubsystem<Network>()->IsServerRunning())
+		return;
+	// The page is only built when someone asks for it
+	if (metricsEndpoint_.Poll(timeStep))
+		metricsEndpoint_.Respond(BuildMetricsPage());
+
+	const String& fileName = engineParameters_["MetricsFile"].GetString();
+	if (fileName.Empty())
+		return;
+	metricsFileTimer_ += timeStep;
+	if (metricsFileTimer_ < METRICS_FILE_INTERVAL)
+		return;
+	metricsFileTimer_ = 0.0f;
+	// Write beside the page and swap it in, so a reader never sees half of it. Rename does not replace on Windows
+	String page = BuildMetricsPage();
+	String tempName = fileName + ".tmp";
+	{
+		File file(context_, tempName, FILE_WRITE);
+		if (!file.IsOpen())
+			return;
+		file.Write(page.CString(), page.Length());
+	}
+	FileSystem* fileSystem = GetSubsystem<FileSystem>();
+	fileSystem->Delete(fileName);
+	fileSystem->Rename(tempName, fileName);
+}
+
+String CharacterDemo::BuildMetricsPage()
+{
+	String page;
+	tickSeconds_.Write(page, "boids_tick_duration_seconds", "Server tick from physics pre-step to post-step: controls, flock, eating and Bullet.");
+	flockStepSeconds_.Write(page, "boids_flock_step_seconds", "Flock update within each tick.");
+	WriteMetricHeader(page, "boids_ticks_total", "counter", "Server ticks run.");
+	WriteMetricValue(page, "boids_ticks_total", ticks_);
+	WriteMetricHeader(page, "boids_fish_active", "gauge", "Fish swimming.");
+	WriteMetricValue(page, "boids_fish_active", boidset.GetNumBoids());
+	WriteMetricHeader(page, "boids_flock_index", "gauge", "Spatial index backend the flock runs on, 1 for the current one.");
+	for (unsigned i = FLOCK_INDEX_GRID; i < MAX_FLOCK_INDEX_TYPES; i++)
+		WriteMetricValue(page, "boids_flock_index", "backend", GetFlockIndexName((FlockIndexType)i), boidset.GetIndexType() == i ? 1 : 0);
+	WriteMetricHeader(page, "boids_fish_waiting_respawn", "gauge", "Eaten fish waiting to swim back in.");
+	WriteMetricValue(page, "boids_fish_waiting_respawn", boidset.GetNumRespawns());
+	WriteMetricHeader(page, "boids_fish_eaten_total", "counter", "Fish eaten by players.");
+	WriteMetricValue(page, "boids_fish_eaten_total", boidset.GetNumEaten());
+	WriteMetricHeader(page, "boids_fish_respawned_total", "counter", "Eaten fish brought back.");
+	WriteMetricValue(page, "boids_fish_respawned_total", boidset.GetNumRespawned());
+
+	const Vector<SharedPtr<Connection> >& connections = GetSubsystem<Network>()->GetClientConnections();
+	WriteMetricHeader(page, "boids_clients_connected", "gauge", "Client connections.");
+	WriteMetricValue(page, "boids_clients_connected", connections.Size());
+	WriteMetricHeader(page, "boids_client_bytes_in_per_second", "gauge", "Bytes received from each client per second.");
+	for (unsigned i = 0; i < connections.Size(); ++i)
+		WriteMetricValue(page, "boids_client_bytes_in_per_second", "client", connections[i]->ToString(), connections[i]->GetBytesInPerSec());
+	WriteMetricHeader(page, "boids_client_bytes_out_per_second", "gauge", "Bytes sent to each client per second.");
+	for (unsigned i = 0; i < connections.Size(); ++i)
+		WriteMetricValue(page, "boids_client_bytes_out_per_second", "client", connections[i]->ToString(), connections[i]->GetBytesOutPerSec());
+	WriteMetricHeader(page, "boids_client_rtt_seconds", "gauge", "Round trip time to each client.");
+	for (unsigned i = 0; i < connections.Size(); ++i)
+		WriteMetricValue(page, "boids_client_rtt_seconds", "client", connections[i]->ToString(), connections[i]->GetRoundTripTime());
+	return page;
+}
+
 void CharacterDemo::HandleQuit(StringHash eventType, VariantMap& eventData)
 {
 	engine_->Exit();
@@ -589,6 +1073,10 @@ void CharacterDemo::HandleDisconnect(StringHash eventType, VariantMap & eventDat
 	{
 		serverConnection->Disconnect();
 		scene_->Clear(true, false);
+		conePredictor_.Clear();
+		flockReplica.Clear();
+		flockSyncClient.Clear();
+		coneBuffers_.Clear();
 		clientObjectID_ = 0;
 	}
 	// Running as a server, stop it
@@ -651,11 +1139,13 @@ Node * CharacterDemo::CreateControllableObject()
 	// motion damping so that the ball can not accelerate limitlessly
 	body->SetLinearDamping(0.5f);
 	body->SetAngularDamping(0.5f);
-	body->SetCollisionLayer(2);
+	// Fish leave this layer out of their collision mask, eating is done against the flock spatial index
+	body->SetCollisionLayer(PLAYER_COLLISION_LAYER);
 	
 	CollisionShape* shape = ClientCone->CreateComponent<CollisionShape>();
 	shape->SetConvexHull(ConeObject->GetModel());
-	//SubscribeToEvent(ClientCone, E_NODECOLLISION, URHO3D_HANDLER(CharacterDemo, HandleNodeCollision));
+	// Walls and floor push the cone back
+	SubscribeToEvent(ClientCone, E_NODECOLLISION, URHO3D_HANDLER(CharacterDemo, HandleNodeCollision));
 	return ClientCone;
 
 	
@@ -686,6 +1176,10 @@ void CharacterDemo::HandleServerToClientObjectID(StringHash eventType, VariantMa
 {
 	clientObjectID_ = eventData[PLAYER_ID].GetUInt();
 	printf("Client ID : %i \n", clientObjectID_);
+	// The server moves the cone one of its ticks per input, so predict and replay each input over the same step
+	int tickRate = eventData[TICK_RATE].GetInt();
+	if (tickRate > 0)
+		scene_->GetComponent<PhysicsWorld>()->SetFps(tickRate);
 
 }
 
@@ -702,6 +1196,7 @@ void CharacterDemo::HandleClientToServerReadyToStart(StringHash eventType, Varia
 	// Finally send the object's node ID using a remote event
 	VariantMap remoteEventData;
 	remoteEventData[PLAYER_ID] = newObject->GetID();
+	remoteEventData[TICK_RATE] = engineParameters_["TickRate"].GetInt();
 	newConnection->SendRemoteEvent(E_CLIENTOBJECTAUTHORITY, true, remoteEventData);
 }
 
@@ -720,7 +1215,18 @@ void CharacterDemo::HandleClientDisconnected(StringHash eventType, VariantMap &
 {
 	Log::WriteRaw("(Disconnected) A Client has Disconnected");
 	using namespace ClientConnected;
-
+	Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+	flockWriter.RemoveConnection(connection);
+	flockSyncServer.RemoveConnection(connection);
+	inputQueues_.Erase(connection);
+	// Remove the client's cone, or every client that leaves would leave it in the scene for the others
+	HashMap<Connection*, WeakPtr<Node> >::Iterator object = serverObjects_.Find(connection);
+	if (object != serverObjects_.End())
+	{
+		if (object->second_)
+			object->second_->Remove();
+		serverObjects_.Erase(object);
+	}
 }
 
 Controls CharacterDemo::FromClientToServerControls()
@@ -743,7 +1249,8 @@ Controls CharacterDemo::FromClientToServerControls()
 
 void CharacterDemo::ProcessClientControls(float Timestep)
 {
-	
+	URHO3D_PROFILE(ClientControls);
+	PhaseTimer timer(&tickProfile_, PHASE_CONTROLS);
 	Network* network = GetSubsystem<Network>();
 	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
 	//Server: go through every client connected
@@ -751,26 +1258,28 @@ void CharacterDemo::ProcessClientControls(float Timestep)
 	{
 
 		Connection* connection = connections[i];
+		PlayerInputQueue& inputs = inputQueues_[connection];
+		inputs.Read(connection->GetControls());
 		// Get the object this connection is controlling
 		Node* ConeNode = serverObjects_[connection];
 		// Client has no item connected
-		if (!ConeNode) continue;
-		RigidBody* body = ConeNode->GetComponent<RigidBody>();
-		// Get the last controls sent by the client
-		const Controls& controls = connection->GetControls();
-		const float MoveSpeed = 15.0f;
-		body->SetRotation(Quaternion(controls.pitch_,controls.yaw_, 0));
-	
-	
-
-		if (controls.buttons_ & CTRL_FORWARD)
-			ConeNode->Translate(Vector3::FORWARD * MoveSpeed* Timestep);
-		if (controls.buttons_ & CTRL_BACK)
-			ConeNode->Translate(Vector3::BACK * MoveSpeed * Timestep);
-		if (controls.buttons_ & CTRL_LEFT)
-			ConeNode->Translate(Vector3::LEFT * MoveSpeed * Timestep);
-		if (controls.buttons_ & CTRL_RIGHT)
-			ConeNode->Translate(Vector3::RIGHT * MoveSpeed * Timestep);
+		if (!ConeNode)
+		{
+			inputs.Discard();
+			continue;
+		}
+		// One input a tick like the client made them, a few more when they have piled up behind a late packet
+		Vector3 position = ConeNode->GetPosition();
+		Quaternion rotation = ConeNode->GetRotation();
+		PlayerInput input;
+		bool moved = false;
+		while ((!moved || inputs.GetSize() > PLAYER_INPUT_BACKLOG) && inputs.Pop(input))
+		{
+			MoveCone(position, rotation, input, Timestep);
+			moved = true;
+		}
+		if (moved)
+			ConeNode->SetTransform(position, rotation);
 	}
 
 
@@ -788,17 +1297,181 @@ void CharacterDemo::HandlePhysicsPreStep(StringHash eventType, VariantMap & even
 	{
 
 		serverConnection->SetPosition(cameraNode_->GetPosition()); // send camera position too
-		serverConnection->SetControls(FromClientToServerControls()); // send controls to server
+		// move our own cone straight away, the controls carry every input the server has not confirmed
+		Controls controls;
+		if (bot_)
+			loadBot_.Generate(controls, Timestep);
+		else
+			controls = FromClientToServerControls();
+		conePredictor_.Step(controls, Timestep);
+		if (bot_)
+			loadBot_.InputSent(conePredictor_.GetLastSequence(), GetSubsystem<Time>()->GetElapsedTime());
+		serverConnection->SetControls(controls); // send controls to server
 
 	}
 	// Server: Read Controls, Apply them if needed
 	else if (network->IsServerRunning())
 	{
-	
+		tickTimer_.Reset();
 		ProcessClientControls(Timestep); // take data from clients, process it
-		boidset.Update(Timestep);
+		{
+			URHO3D_PROFILE(FlockStep);
+			HiresTimer flockTimer;
+			boidset.Update(Timestep, &tickProfile_);
+			float flockTime = flockTimer.GetUSec(false) / 1000.0f;
+			tickProfile_.Record(PHASE_FLOCKSTEP, flockTime);
+			flockStepSeconds_.Observe(flockTime / 1000.0f);
+		}
+		CheckCollision(); // players eat the fish the step has brought within reach
+	}
+
+}
+
+void CharacterDemo::HandlePhysicsPostStep(StringHash eventType, VariantMap & eventData)
+{
+	if (GetSubsystem<Network>()->IsServerRunning())
+	{
+		float tickTime = tickTimer_.GetUSec(false) / 1000.0f;
+		tickProfile_.Record(PHASE_TICK, tickTime);
+		tickSeconds_.Observe(tickTime / 1000.0f);
+		ticks_++;
 	}
+}
 
+void CharacterDemo::HandleNetworkUpdate(StringHash eventType, VariantMap & eventData)
+{
+	Network* network = GetSubsystem<Network>();
+	Connection* serverConnection = network->GetServerConnection();
+	// Client: tell the server which flock messages arrived so it can delta against them
+	if (serverConnection)
+	{
+		VectorBuffer ack;
+		if (flockReplica.WriteAck(ack))
+			serverConnection->SendMessage(MSG_FLOCKACK, false, false, ack);
+	}
+	else if (network->IsServerRunning())
+	{
+		URHO3D_PROFILE(Replication);
+		PhaseTimer timer(&tickProfile_, PHASE_REPLICATION);
+		SendConeStates();
+		// Client simulated flock: only the events and a slice of exact states go out
+		if (engineParameters_["FlockClientSim"].GetBool())
+			flockSyncServer.Send(boidset, 1.0f / scene_->GetComponent<PhysicsWorld>()->GetFps(), network);
+		// Otherwise quantise the flock once, then write each client its own stream around its camera
+		else
+		{
+			flockWriter.Prepare(boidset, boidset.GetBounds());
+			const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+			for (unsigned i = 0; i < connections.Size(); ++i)
+			{
+				if (connections[i]->IsSceneLoaded())
+					flockWriter.Send(connections[i]);
+			}
+		}
+	}
+}
+
+void CharacterDemo::SendConeStates()
+{
+	Network* network = GetSubsystem<Network>();
+	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		Connection* connection = connections[i];
+		Node* ConeNode = serverObjects_[connection];
+		if (!ConeNode)
+			continue;
+		VectorBuffer state;
+		state.WriteUInt(inputQueues_[connection].GetLastApplied());
+		state.WriteVector3(ConeNode->GetPosition());
+		connection->SendMessage(MSG_CONESTATE, false, false, state);
+	}
+}
+
+void CharacterDemo::HandleNetworkMessage(StringHash eventType, VariantMap & eventData)
+{
+	using namespace NetworkMessage;
+	int messageID = eventData[P_MESSAGEID].GetInt();
+	if (messageID != MSG_FLOCKSNAPSHOT && messageID != MSG_FLOCKACK && messageID != MSG_FLOCKKEYFRAME && messageID != MSG_FLOCKEVENTS &&
+		messageID != MSG_CONESTATE)
+		return;
+	MemoryBuffer message(eventData[P_DATA].GetBuffer());
+	// Client: where the server has our cone, replay the inputs it has not applied yet from there
+	if (messageID == MSG_CONESTATE)
+	{
+		// Bot: time the inputs this state confirms, then read it again for the predictor
+		if (bot_)
+		{
+			loadBot_.ConeStateReceived(message.ReadUInt(), GetSubsystem<Time>()->GetElapsedTime());
+			message.Seek(0);
+		}
+		conePredictor_.Reconcile(message);
+	}
+	// Client: keyframe or events of a flock it simulates itself
+	else if (messageID == MSG_FLOCKKEYFRAME || messageID == MSG_FLOCKEVENTS)
+		flockSyncClient.Read(messageID, message);
+	// Client: move the local fish from a flock snapshot
+	else if (messageID == MSG_FLOCKSNAPSHOT)
+		flockReplica.Read(message, GetSubsystem<Time>()->GetElapsedTime());
+	// Server: a client acknowledging flock messages
+	else
+		flockWriter.Acknowledge(static_cast<Connection*>(eventData[P_CONNECTION].GetPtr()), message);
+}
+
+void CharacterDemo::HandleInterceptNetworkUpdate(StringHash eventType, VariantMap & eventData)
+{
+	// Client: a player cone transform from the server goes into its snapshot buffer instead of onto the node
+	using namespace InterceptNetworkUpdate;
+	Node* node = static_cast<Node*>(eventData[P_SERIALIZABLE].GetPtr());
+	HashMap<unsigned, SnapshotBuffer>::Iterator it = coneBuffers_.Find(node->GetID());
+	if (it == coneBuffers_.End())
+		return;
+	SnapshotBuffer& buffer = it->second_;
+	Vector3 position;
+	Quaternion rotation;
+	buffer.GetLatest(position, rotation);
+	if (eventData[P_NAME].GetString() == "Network Position")
+		position = eventData[P_VALUE].GetVector3();
+	else
+	{
+		// The node sends its rotation packed
+		MemoryBuffer packed(eventData[P_VALUE].GetBuffer());
+		rotation = packed.ReadPackedQuaternion();
+	}
+	buffer.Add(GetSubsystem<Time>()->GetElapsedTime(), position, rotation);
+}
+
+void CharacterDemo::UpdatePlayerCones(float time)
+{
+	// Take over the transform of player cones as they are replicated in
+	const Vector<SharedPtr<Node> >& children = scene_->GetChildren();
+	for (unsigned i = 0; i < children.Size(); ++i)
+	{
+		Node* node = children[i];
+		if (node->GetNameHash() != PLAYER_CONE_NAME || coneBuffers_.Contains(node->GetID()))
+			continue;
+		node->SetInterceptNetworkUpdate("Network Position", true);
+		node->SetInterceptNetworkUpdate("Network Rotation", true);
+		coneBuffers_[node->GetID()].Add(time, node->GetPosition(), node->GetRotation());
+	}
+
+	float delay = engineParameters_["InterpolationDelay"].GetFloat();
+	for (HashMap<unsigned, SnapshotBuffer>::Iterator it = coneBuffers_.Begin(); it != coneBuffers_.End();)
+	{
+		Node* node = scene_->GetNode(it->first_);
+		// Player left
+		if (!node)
+		{
+			it = coneBuffers_.Erase(it);
+			continue;
+		}
+		// Own cone is predicted instead, the buffer only keeps the server from moving it
+		Vector3 position;
+		Quaternion rotation;
+		if ((it->first_ != clientObjectID_ || !conePredictor_.IsActive()) && it->second_.Sample(time - delay, position, rotation))
+			node->SetTransform(position, rotation);
+		++it;
+	}
 }
 
 void CharacterDemo::HandleClientFinishedLoading(StringHash eventType, VariantMap & eventData)
@@ -819,21 +1492,8 @@ void CharacterDemo::HandleNodeCollision(StringHash eventType, VariantMap& eventD
 	RigidBody* ConeBody = static_cast<RigidBody*>(eventData[P_BODY].GetPtr());
 	RigidBody* OtherBody = static_cast<RigidBody*>(eventData[P_OTHERBODY].GetPtr());
 	Node* Client = ConeBody->GetNode();
-	Log::WriteRaw("Node: "+Nodes->GetName()+" \n");
 	
 	Vector3 TempPos;
-	int number = Nodes->GetName().Compare("Cone");
-	if(Nodes->GetName().Compare("Cone") == 0)
-	{ 
-		score++;
-		
-		printf("Client %i 's ", Client->GetID());
-		printf("Score is: %i \n", score);
-		Nodes->SetPosition(Vector3(130.0f,0.0f,0.0f));
-		Nodes->SetScale(5.0f);
-		OtherBody->SetLinearVelocity(Vector3::ZERO);
-		OtherBody->SetMass(0.0f);
-	}
 	//ConeBody->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
 	if (Nodes->GetName().Compare("Wall") == 0)
 	{	
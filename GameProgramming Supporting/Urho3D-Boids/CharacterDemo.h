@@ -22,7 +22,14 @@
 
 #pragma once
 
+#include <Urho3D/Core/Timer.h>
+
+#include "LoadTest.h"
+#include "Metrics.h"
+#include "PlayerInput.h"
 #include "Sample.h"
+#include "SnapshotBuffer.h"
+#include "TickProfile.h"
 
 namespace Urho3D
 {
@@ -47,6 +54,8 @@ class CharacterDemo : public Sample
 {
     URHO3D_OBJECT(CharacterDemo, Sample);
 	static const unsigned short SERVER_PORT = 2345;
+	static const int DEFAULT_TICK_RATE = 60;
+	static const int DEFAULT_NETWORK_FPS = 30;
 public:
     /// Construct.
     CharacterDemo(Context* context);
@@ -58,6 +67,8 @@ public:
 	bool MenuVisable = true;
 
 	SharedPtr<Window> window_;
+    /// Setup before engine initialization. Reads the flock size from the command line.
+    virtual void Setup();
     /// Setup after engine initialization and before running the main loop.
     virtual void Start();
 
@@ -111,8 +122,16 @@ protected:
 private:
     /// Create static scene content.
     void CreateServerScene();
+    /// Create the camera, lighting, water and sky of the server scene. Skipped when headless.
+    void CreateServerVisuals();
+    /// Start a dedicated server with no window, UI or camera.
+    void StartHeadlessServer();
+    /// Start a headless load test client that joins the server and plays with random controls.
+    void StartBot();
 
 	void CreateClientScene();
+    /// Create the camera, lighting, water and sky of the client scene. Skipped when headless.
+    void CreateClientVisuals();
     /// Create controllable character.
     void CreateCharacter();
     /// Construct an instruction text to the UI.
@@ -135,6 +154,7 @@ private:
 	void CreateMainMenu();
 	Button* CreateButton(const String& text, int pHeight,Font* font, Urho3D::Window*whichWindow);
 	LineEdit* CreateLineEdit(const String& text, int pHeight,Font* font, Urho3D::Window*whichWindow);
+	// Server: let every player cone eat the fish within reach, after each flock step.
 	void CheckCollision();
 	void CharacterDemo::HandleQuit(StringHash eventType, VariantMap& eventData);
 	void CharacterDemo::HandleConnect(StringHash eventType, VariantMap& eventData);
@@ -147,6 +167,8 @@ private:
 	Node* CreateWalls();
 	unsigned clientObjectID_ = 0; // Client: ID of own object
 	HashMap<Connection*, WeakPtr<Node> > serverObjects_; // Server Client/Object HashMap
+	HashMap<Connection*, PlayerInputQueue> inputQueues_; // Server: inputs of each client waiting for their tick
+	PlayerPredictor conePredictor_; // Client: prediction of own object
 	 // Handle remote event from server to Client to share controlled object node ID.
 	void HandleServerToClientObjectID(StringHash eventType, VariantMap& eventData);
 	// Handle remote event, client tells server that client is ready to start game
@@ -159,7 +181,33 @@ private:
 
 	Controls FromClientToServerControls();
 	void ProcessClientControls(float Timestep);
+	// Server: send each player the position of their cone and the last input applied to it.
+	void SendConeStates();
 	void HandlePhysicsPreStep(StringHash eventType, VariantMap & eventData);
+	// Server: time the tick that the pre-step started.
+	void HandlePhysicsPostStep(StringHash eventType, VariantMap & eventData);
+	// Headless: join and steer the cone as a bot, and log a load report every -loadreport seconds.
+	void UpdateLoadTest(float timeStep);
+	// Headless: log the rolling load figures.
+	void WriteLoadReport();
+	// Server: log the tick phase timings every -profilelog seconds when headless, or show them in the DebugHud.
+	void UpdateTickProfile(float timeStep);
+	// Server: listen for metrics scrapes on -metricsport, if given.
+	void StartMetrics();
+	// Server: answer metrics scrapes and rewrite the -metricsfile page.
+	void UpdateMetrics(float timeStep);
+	// Server: the metrics page, counters, gauges and histograms in the Prometheus text format.
+	String BuildMetricsPage();
+	// Server: send each client its flock stream with every network update. Client: acknowledge the stream.
+	void HandleNetworkUpdate(StringHash eventType, VariantMap& eventData);
+	// Client: receive flock snapshots and own cone states. Server: receive flock acknowledgements.
+	void HandleNetworkMessage(StringHash eventType, VariantMap& eventData);
+	// Client: buffer player cone transforms instead of applying them.
+	void HandleInterceptNetworkUpdate(StringHash eventType, VariantMap& eventData);
+	// Client: start buffering newly replicated player cones and place every cone from its buffer.
+	void UpdatePlayerCones(float time);
+	// Client: recent server transforms of each player cone, by node ID
+	HashMap<unsigned, SnapshotBuffer> coneBuffers_;
 	void HandleClientFinishedLoading(StringHash eventType, VariantMap& eventData);
 	void HandleCustomEventByOlivier(StringHash eventType, VariantMap& eventData);
 	
@@ -171,4 +219,27 @@ private:
     WeakPtr<Character> character_;
     /// First person camera flag.
     bool firstPerson_;
+    /// Running as a dedicated server without graphics.
+    bool headless_;
+    /// Running as a headless load test client.
+    bool bot_;
+    /// Bot: random controls and input latency.
+    LoadTestBot loadBot_;
+    /// Server: milliseconds of each tick phase. The whole tick runs from the physics pre-step to its post-step,
+    /// so it includes Bullet.
+    TickProfile tickProfile_;
+    HiresTimer tickTimer_;
+    /// Seconds since the last load report.
+    float reportTimer_;
+    /// Seconds since the tick profile was last logged or shown.
+    float profileTimer_;
+    /// Server: local HTTP endpoint of the metrics page.
+    MetricsEndpoint metricsEndpoint_;
+    /// Server: every tick duration and flock update in seconds since the start.
+    MetricsHistogram tickSeconds_;
+    MetricsHistogram flockStepSeconds_;
+    /// Server: ticks run since the start.
+    unsigned ticks_;
+    /// Seconds since the metrics file was last written.
+    float metricsFileTimer_;
 };
@@ -0,0 +1,792 @@
+// Microbenchmark of the flock core phases: index build, neighbour search, force computation and integration, timed
+// separately over flock sizes, boid distributions, spatial index backends and thread counts, then whole steps with
+// the index kept up the way the game does. Results go to stdout as JSON or CSV, progress to stderr.
+//
+//   FlockBench [--sizes 1000,10000,100000,1000000] [--threads 1,2,4,8] [--dists uniform,clustered,school]
+//              [--index grid,hashed,kdtree,octree,auto] [--leafsize 64] [--repeat 5] [--density 4]
+//              [--maxneighbours 0] [--skin 0] [--noincremental] [--nosimd] [--nofarfield] [--format json|csv]
+//
+// With --check it times nothing and instead checks a small flock of each distribution on each backend against a brute
+// force reference, printing one line per check and exiting with 1 if any failed.
+
+#include "../FlockIndex.h"
+#include "../FlockRules.h"
+#include "../FlockState.h"
+#include "../FlockVerlet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BenchOptions
+{
+	BenchOptions() :
+		leafSize(FlockIndexSettings().leafSize),
+		repeat(5),
+		density(4.0f),
+		maxNeighbours(0),
+		skin(0.0f),
+		incremental(true),
+		useSimd(true),
+		farField(true),
+		csv(false),
+		check(false)
+	{
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+		sizes.push_back(1000000);
+		unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned t = 1; t < hardware; t *= 2)
+			threads.push_back(t);
+		threads.push_back(hardware);
+		distributions.push_back("uniform");
+		distributions.push_back("clustered");
+		distributions.push_back("school");
+		indices.push_back("grid");
+	}
+
+	std::vector<unsigned> sizes;
+	std::vector<unsigned> threads;
+	std::vector<std::string> distributions;
+	//spatial index backends by name, auto picks one per distribution the way the game does
+	std::vector<std::string> indices;
+	unsigned leafSize;
+	//timed runs per measurement, the median is reported
+	unsigned repeat;
+	//average boids per grid cell, the tank grows with the flock so uniform density stays the same
+	float density;
+	unsigned maxNeighbours;
+	//Verlet skin of the step phase, 0 builds the index every step
+	float skin;
+	//grid upkeep of the step phase moves only the boids that changed cell
+	bool incremental;
+	bool useSimd;
+	bool farField;
+	bool csv;
+	//check the backends against brute force instead of timing them
+	bool check;
+};
+
+//flock steps of the step phase, long enough for a few Verlet rebuilds at the usual skins
+static const unsigned BENCH_STEPS = 30;
+//flock size of --check, small enough to test every boid against every other
+static const unsigned CHECK_BOIDS = 2000;
+//flock steps of --check between the checks on the initial flock and on the moved one
+static const unsigned CHECK_STEPS = 20;
+
+struct BenchResult
+{
+	std::string phase;
+	std::string distribution;
+	std::string index;
+	unsigned boids;
+	unsigned threads;
+	double nsPerBoid;
+	//single thread time over threads x this time, 1 is perfect scaling
+	double efficiency;
+	double neighboursPerBoid;
+};
+
+//counts the boids within the attract range, the widest rule, without doing any of the force maths
+struct NeighbourCount
+{
+	NeighbourCount(const FlockIndex& index, float x, float y, float z, float range) :
+		index_(index),
+		x_(x),
+		y_(y),
+		z_(z),
+		rangeSq_(range * range),
+		count_(0)
+	{
+	}
+
+	void operator()(unsigned slot)
+	{
+		float dx = x_ - index_.px_[slot];
+		float dy = y_ - index_.py_[slot];
+		float dz = z_ - index_.pz_[slot];
+		float d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 > 0.0f && d2 < rangeSq_)
+			count_++;
+	}
+
+	const FlockIndex& index_;
+	float x_, y_, z_;
+	float rangeSq_;
+	unsigned count_;
+};
+
+static std::vector<unsigned> ParseList(const char* text)
+{
+	std::vector<unsigned> values;
+	const char* cursor = text;
+	while (*cursor)
+	{
+		char* end;
+		unsigned long value = strtoul(cursor, &end, 10);
+		if (end == cursor)
+			break;
+		values.push_back((unsigned)value);
+		cursor = *end == ',' ? end + 1 : end;
+	}
+	return values;
+}
+
+static std::vector<std::string> ParseNames(const char* text)
+{
+	std::vector<std::string> names;
+	std::string list(text);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t comma = list.find(',', start);
+		if (comma == std::string::npos)
+			comma = list.size();
+		if (comma > start)
+			names.push_back(list.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return names;
+}
+
+//fill the state with a fixed seed so every run benchmarks the same flock
+static void Populate(FlockState& state, unsigned numBoids, const std::string& distribution, float halfSize)
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	state.Resize(numBoids);
+
+	//clustered: sixteen schools, school: one school holding the whole flock
+	unsigned numCentres = distribution == "clustered" ? 16 : 1;
+	float sigma = distribution == "clustered" ? halfSize / 16.0f : halfSize / 8.0f;
+	std::vector<float> centreX(numCentres), centreZ(numCentres);
+	for (unsigned c = 0; c < numCentres; c++)
+	{
+		centreX[c] = (unit(random) * 1.6f - 0.8f) * halfSize;
+		centreZ[c] = (unit(random) * 1.6f - 0.8f) * halfSize;
+	}
+	std::normal_distribution<float> spread(0.0f, sigma);
+
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		float x, z;
+		if (distribution == "uniform")
+		{
+			x = (unit(random) * 2.0f - 1.0f) * halfSize;
+			z = (unit(random) * 2.0f - 1.0f) * halfSize;
+		}
+		else
+		{
+			unsigned c = i % numCentres;
+			x = std::min(std::max(centreX[c] + spread(random), -halfSize), halfSize);
+			z = std::min(std::max(centreZ[c] + spread(random), -halfSize), halfSize);
+		}
+		//headings climb or dive up to about 30 degrees
+		float heading = unit(random) * 6.2831853f;
+		float pitch = (unit(random) - 0.5f) * 1.0f;
+		float speed = BOID_MIN_SPEED + unit(random) * (BOID_MAX_SPEED - BOID_MIN_SPEED);
+		state.px[i] = x;
+		state.py[i] = BOID_MIN_Y + unit(random) * (BOID_MAX_Y - BOID_MIN_Y);
+		state.pz[i] = z;
+		state.vx[i] = cosf(heading) * cosf(pitch) * speed;
+		state.vy[i] = sinf(pitch) * speed;
+		state.vz[i] = sinf(heading) * cosf(pitch) * speed;
+		state.fx[i] = state.fy[i] = state.fz[i] = 0.0f;
+	}
+}
+
+//size the tank to the flock so the grid holds the average density, and set the rules and index up from the options.
+//Return the half size of the tank
+static float SetUpTank(unsigned numBoids, const BenchOptions& options, FlockParams& params,
+	FlockIndexSettings& indexSettings)
+{
+	params.maxNeighbours = options.maxNeighbours;
+	params.useSimd = options.useSimd;
+	params.farField = options.farField;
+	float cellSize = 10.0f;
+	params.searchRadius = cellSize;
+	float halfSize = 0.5f * cellSize * sqrtf(numBoids / options.density);
+	params.minX = params.minZ = -halfSize;
+	params.maxX = params.maxZ = halfSize;
+
+	indexSettings.cellSize = cellSize;
+	indexSettings.leafSize = options.leafSize;
+	indexSettings.minX = indexSettings.minZ = -halfSize;
+	indexSettings.maxX = indexSettings.maxZ = halfSize;
+	indexSettings.minY = BOID_MIN_Y;
+	indexSettings.maxY = BOID_MAX_Y;
+	indexSettings.incremental = options.incremental;
+	return halfSize;
+}
+
+//run work(begin, end) over [0, count) split into one contiguous range per thread, the calling thread takes the first
+template <class Work> static void RunParallel(unsigned count, unsigned numThreads, const Work& work)
+{
+	if (numThreads <= 1)
+	{
+		work(0u, count);
+		return;
+	}
+	std::vector<std::thread> workers;
+	unsigned chunk = (count + numThreads - 1) / numThreads;
+	for (unsigned t = 1; t < numThreads; t++)
+	{
+		unsigned begin = std::min(t * chunk, count);
+		unsigned end = std::min(begin + chunk, count);
+		workers.push_back(std::thread(work, begin, end));
+	}
+	work(0u, std::min(chunk, count));
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+//median seconds of repeat runs of body, after one untimed warm up run
+template <class Body> static double TimeMedian(unsigned repeat, const Body& body)
+{
+	body();
+	std::vector<double> times;
+	for (unsigned r = 0; r < repeat; r++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+static void PrintResults(const std::vector<BenchResult>& results, const BenchOptions& options)
+{
+	if (options.csv)
+	{
+		printf("phase,distribution,index,boids,threads,ns_per_boid,efficiency,neighbours_per_boid\n");
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult& r = results[i];
+			printf("%s,%s,%s,%u,%u,%.3f,%.3f,%.2f\n", r.phase.c_str(), r.distribution.c_str(), r.index.c_str(), r.boids,
+				r.threads, r.nsPerBoid, r.efficiency, r.neighboursPerBoid);
+		}
+		return;
+	}
+
+	printf("{\n  \"simd\": %s,\n  \"far_field\": %s,\n  \"max_neighbours\": %u,\n  \"density\": %.2f,\n"
+		"  \"leaf_size\": %u,\n  \"skin\": %.2f,\n  \"incremental\": %s,\n  \"repeat\": %u,\n  \"results\": [\n",
+		options.useSimd ? "true" : "false", options.farField ? "true" : "false", options.maxNeighbours, options.density,
+		options.leafSize, options.skin, options.incremental ? "true" : "false", options.repeat);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		printf("    {\"phase\": \"%s\", \"distribution\": \"%s\", \"index\": \"%s\", \"boids\": %u, \"threads\": %u, "
+			"\"ns_per_boid\": %.3f, \"efficiency\": %.3f, \"neighbours_per_boid\": %.2f}%s\n", r.phase.c_str(),
+			r.distribution.c_str(), r.index.c_str(), r.boids, r.threads, r.nsPerBoid, r.efficiency, r.neighboursPerBoid,
+			i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+//number of forces of two states that differ in any bit
+static unsigned CountForceMismatches(const FlockState& a, const FlockState& b)
+{
+	unsigned mismatches = 0;
+	for (size_t i = 0; i < a.fx.size(); i++)
+	{
+		if (memcmp(&a.fx[i], &b.fx[i], sizeof(float)) || memcmp(&a.fy[i], &b.fy[i], sizeof(float)) ||
+			memcmp(&a.fz[i], &b.fz[i], sizeof(float)))
+			mismatches++;
+	}
+	return mismatches;
+}
+
+//number of forces of two states further apart than the rounding of sums taken in a different order
+static unsigned CountForceDifferences(const FlockState& a, const FlockState& b)
+{
+	unsigned differences = 0;
+	for (size_t i = 0; i < a.fx.size(); i++)
+	{
+		float scale = 1.0f + std::max(std::max(fabsf(a.fx[i]), fabsf(a.fy[i])), fabsf(a.fz[i]));
+		if (fabsf(a.fx[i] - b.fx[i]) > 1e-4f * scale || fabsf(a.fy[i] - b.fy[i]) > 1e-4f * scale ||
+			fabsf(a.fz[i] - b.fz[i]) > 1e-4f * scale)
+			differences++;
+	}
+	return differences;
+}
+
+//print the outcome of one check and count it if it failed
+static void ReportCheck(const char* check, const std::string& distribution, const std::string& index, unsigned failures,
+	unsigned& failedChecks)
+{
+	if (failures)
+	{
+		printf("%s, %s, %s: FAILED, %u mismatches\n", check, distribution.c_str(), index.c_str(), failures);
+		failedChecks++;
+	}
+	else
+		printf("%s, %s, %s: ok\n", check, distribution.c_str(), index.c_str());
+}
+
+//every boid within radius of every boid has to be in the runs of its query exactly once, and the runs must stay
+//inside the sorted slots. Return the number of boids missing, repeated or out of range
+static unsigned CheckGatherRuns(const FlockState& state, const FlockIndex& index, float radius)
+{
+	unsigned numBoids = state.Size();
+	if (index.GetNumSorted() != numBoids)
+		return numBoids;
+	unsigned failures = 0;
+	float radiusSq = radius * radius;
+	std::vector<unsigned> seen(numBoids, 0);
+	std::vector<FlockRun> runs;
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		unsigned stamp = i + 1;
+		runs.clear();
+		index.GatherRuns(state.px[i], state.py[i], state.pz[i], radius, 0, runs);
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			if (runs[r].begin > runs[r].end || runs[r].end > numBoids)
+			{
+				failures++;
+				continue;
+			}
+			for (unsigned slot = runs[r].begin; slot < runs[r].end; slot++)
+			{
+				unsigned boid = index.sortedIndex_[slot];
+				if (seen[boid] == stamp)
+					failures++;
+				seen[boid] = stamp;
+			}
+		}
+		for (unsigned j = 0; j < numBoids; j++)
+		{
+			float dx = state.px[j] - state.px[i];
+			float dy = state.py[j] - state.py[i];
+			float dz = state.pz[j] - state.pz[i];
+			if (dx * dx + dy * dy + dz * dz < radiusSq && seen[j] != stamp)
+				failures++;
+		}
+	}
+	return failures;
+}
+
+//with a far radius reaching every group the near runs and the far field together have to count every boid exactly
+//once, the hashed grid adds nothing to the far field. Return the number of queries that miss boids or count some twice
+static unsigned CheckFarField(const FlockState& state, const FlockIndex& index, float nearRadius, float farRadius)
+{
+	unsigned numBoids = state.Size();
+	unsigned failures = 0;
+	std::vector<FlockRun> runs;
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		runs.clear();
+		index.GatherRuns(state.px[i], state.py[i], state.pz[i], nearRadius, 0, runs);
+		FlockAggregate far = FlockAggregate();
+		index.SumFar(state.px[i], state.py[i], state.pz[i], nearRadius, farRadius, far);
+		unsigned nearCount = 0;
+		for (size_t r = 0; r < runs.size(); r++)
+			nearCount += runs[r].end - runs[r].begin;
+		if (index.GetType() == FLOCK_INDEX_HASHED ? far.count != 0 : nearCount + far.count != numBoids)
+			failures++;
+	}
+	return failures;
+}
+
+//forces of the boids taken in uneven chunks have to be those of one pass to the bit
+static unsigned CheckChunkedForces(const FlockState& state, const FlockIndex& index, const FlockParams& params)
+{
+	unsigned numBoids = state.Size();
+	FlockState whole = state;
+	FlockState chunked = state;
+	ComputeFlockForces(whole, index, params, 0, numBoids);
+	for (unsigned begin = 0, chunk = 1; begin < numBoids; begin += chunk, chunk = chunk * 3 + 1)
+		ComputeFlockForces(chunked, index, params, begin, std::min(begin + chunk, numBoids));
+	return CountForceMismatches(whole, chunked);
+}
+
+//steps of the flock on Verlet lists, refreshing the index until the drift passes half the skin, have to steer every
+//boid exactly as the plain read phase on the same index would. Return the number of forces that differ
+static unsigned CheckVerletLists(const FlockState& initial, FlockIndex& index, const FlockParams& params, float skin)
+{
+	unsigned numBoids = initial.Size();
+	const float timeStep = 1.0f / 60.0f;
+	FlockVerletLists lists;
+	lists.SetSkin(skin);
+	FlockState state = initial;
+	unsigned failures = 0;
+	for (unsigned step = 0; step < CHECK_STEPS; step++)
+	{
+		bool rebuild = step == 0;
+		if (!rebuild)
+		{
+			index.Refresh(state);
+			rebuild = index.GetDrift() > lists.GetRebuildDrift();
+		}
+		if (rebuild)
+		{
+			index.Build(state);
+			lists.Invalidate(numBoids);
+		}
+		FlockState plain = state;
+		ComputeFlockForces(state, index, lists, params, 0, numBoids);
+		ComputeFlockForces(plain, index, params, 0, numBoids);
+		failures += CountForceMismatches(state, plain);
+		IntegrateFlock(state, params, timeStep);
+	}
+	return failures;
+}
+
+//an index kept incrementally over steps of the flock, with some boids teleported across the tank and some removed
+//the way eaten boids are, has to sort the boids and steer them exactly as one built from scratch every step. Return
+//the number of steps that sorted differently and forces that differ
+static unsigned CheckIncremental(const FlockState& initial, FlockIndexType type, const FlockParams& params,
+	const FlockIndexSettings& indexSettings)
+{
+	FlockIndexSettings incrementalSettings = indexSettings;
+	incrementalSettings.incremental = true;
+	FlockIndexSettings fullSettings = indexSettings;
+	fullSettings.incremental = false;
+	std::unique_ptr<FlockIndex> index = CreateFlockIndex(type, incrementalSettings);
+	//short steps, so that few boids change cell between builds and the grid moves them instead of sorting again
+	const float timeStep = 1.0f / 600.0f;
+	FlockState state = initial;
+	unsigned failures = 0;
+	for (unsigned step = 0; step < CHECK_STEPS; step++)
+	{
+		if (step == CHECK_STEPS / 2)
+		{
+			for (unsigned i = 0; i < state.Size(); i += 37)
+			{
+				state.px[i] = -state.px[i];
+				state.pz[i] = -state.pz[i];
+			}
+			for (unsigned i = 0; i < 10; i++)
+				state.RemoveSwap(i * 101);
+		}
+		std::unique_ptr<FlockIndex> full = CreateFlockIndex(type, fullSettings);
+		index->Build(state);
+		full->Build(state);
+		if (index->sortedIndex_ != full->sortedIndex_)
+			failures++;
+		FlockState fullState = state;
+		ComputeFlockForces(state, *index, params, 0, state.Size());
+		ComputeFlockForces(fullState, *full, params, 0, state.Size());
+		failures += CountForceMismatches(state, fullState);
+		IntegrateFlock(state, params, timeStep);
+	}
+	return failures;
+}
+
+//steps of the flock on an index only refreshed until the drift passes half the skin have to find every boid within
+//the search radius, so with every rule limited to it each boid steers as on an index built from scratch, up to the
+//order of the sums. Past the search radius the forces depend on how far the runs and groups reach, and are left out.
+//Return the number of forces that differ
+static unsigned CheckRefreshedForces(const FlockState& initial, FlockIndexType type, const FlockParams& params,
+	const FlockIndexSettings& indexSettings, float skin)
+{
+	FlockParams nearParams = params;
+	nearParams.rangeAttract = std::min(params.rangeAttract, params.searchRadius);
+	nearParams.rangeRepel = std::min(params.rangeRepel, params.searchRadius);
+	nearParams.rangeAlign = std::min(params.rangeAlign, params.searchRadius);
+	nearParams.farField = false;
+	std::unique_ptr<FlockIndex> index = CreateFlockIndex(type, indexSettings);
+	std::unique_ptr<FlockIndex> fresh = CreateFlockIndex(type, indexSettings);
+	const float timeStep = 1.0f / 60.0f;
+	FlockState state = initial;
+	unsigned failures = 0;
+	for (unsigned step = 0; step < CHECK_STEPS; step++)
+	{
+		bool rebuild = step == 0;
+		if (!rebuild)
+		{
+			index->Refresh(state);
+			rebuild = index->GetDrift() > 0.5f * skin;
+		}
+		if (rebuild)
+			index->Build(state);
+		else
+		{
+			fresh->Build(state);
+			FlockState refreshed = state;
+			FlockState built = state;
+			ComputeFlockForces(refreshed, *index, nearParams, 0, state.Size());
+			ComputeFlockForces(built, *fresh, nearParams, 0, state.Size());
+			failures += CountForceDifferences(refreshed, built);
+		}
+		ComputeFlockForces(state, *index, params, 0, state.Size());
+		IntegrateFlock(state, params, timeStep);
+	}
+	return failures;
+}
+
+//every check on one flock and backend, the flock as populated and again after some steps
+static void CheckIndex(const FlockState& initial, FlockIndexType type, const FlockParams& params,
+	const FlockIndexSettings& indexSettings, float skin, const std::string& distribution, unsigned& failedChecks)
+{
+	std::string indexName = GetFlockIndexName(type);
+	std::unique_ptr<FlockIndex> index = CreateFlockIndex(type, indexSettings);
+	const float timeStep = 1.0f / 60.0f;
+	//twice across the tank, which takes in the boids outside it too
+	float farRadius = 2.0f * (params.maxX - params.minX + params.maxZ - params.minZ + BOID_MAX_Y - BOID_MIN_Y);
+	FlockState state = initial;
+	for (unsigned pass = 0; pass < 2; pass++)
+	{
+		std::string name = distribution + (pass ? " moved" : "");
+		index->Build(state);
+		unsigned failures = CheckGatherRuns(state, *index, params.searchRadius) +
+			CheckGatherRuns(state, *index, params.rangeAttract);
+		ReportCheck("runs", name, indexName, failures, failedChecks);
+		ReportCheck("far field", name, indexName, CheckFarField(state, *index, params.searchRadius, farRadius),
+			failedChecks);
+		ReportCheck("chunked forces", name, indexName, CheckChunkedForces(state, *index, params), failedChecks);
+
+		for (unsigned step = 0; pass == 0 && step < CHECK_STEPS; step++)
+		{
+			index->Build(state);
+			ComputeFlockForces(state, *index, params, 0, state.Size());
+			IntegrateFlock(state, params, timeStep);
+		}
+	}
+	ReportCheck("verlet lists", distribution, indexName, CheckVerletLists(initial, *index, params, skin), failedChecks);
+	ReportCheck("refreshed forces", distribution, indexName,
+		CheckRefreshedForces(initial, type, params, indexSettings, skin), failedChecks);
+	ReportCheck("incremental", distribution, indexName, CheckIncremental(initial, type, params, indexSettings),
+		failedChecks);
+}
+
+//check every backend on a small flock of each distribution against brute force. Return true if every check passed
+static bool RunChecks(const BenchOptions& options)
+{
+	FlockParams params;
+	FlockIndexSettings indexSettings;
+	float halfSize = SetUpTank(CHECK_BOIDS, options, params, indexSettings);
+	//without a skin on the command line the lists are checked at one wide enough to be refreshed a few times
+	float skin = options.skin > 0.0f ? options.skin : 2.0f;
+	unsigned failedChecks = 0;
+	for (size_t d = 0; d < options.distributions.size(); d++)
+	{
+		const std::string& distribution = options.distributions[d];
+		FlockState initial;
+		Populate(initial, CHECK_BOIDS, distribution, halfSize);
+		//a few boids outside the tank, which every backend still has to index
+		initial.px[0] = halfSize + 50.0f;
+		initial.pz[1] = -halfSize - 50.0f;
+		initial.py[2] = BOID_MAX_Y + 20.0f;
+		initial.py[3] = BOID_MIN_Y - 20.0f;
+		for (unsigned t = FLOCK_INDEX_AUTO + 1; t < MAX_FLOCK_INDEX_TYPES; t++)
+			CheckIndex(initial, (FlockIndexType)t, params, indexSettings, skin, distribution, failedChecks);
+	}
+	if (failedChecks)
+		printf("%u checks failed\n", failedChecks);
+	else
+		printf("all checks passed\n");
+	return failedChecks == 0;
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (argument == "--sizes" && hasValue)
+			options.sizes = ParseList(argv[++i]);
+		else if (argument == "--threads" && hasValue)
+			options.threads = ParseList(argv[++i]);
+		else if (argument == "--dists" && hasValue)
+			options.distributions = ParseNames(argv[++i]);
+		else if (argument == "--index" && hasValue)
+			options.indices = ParseNames(argv[++i]);
+		else if (argument == "--leafsize" && hasValue)
+			options.leafSize = std::max((unsigned)atoi(argv[++i]), 1u);
+		else if (argument == "--repeat" && hasValue)
+			options.repeat = std::max((unsigned)atoi(argv[++i]), 1u);
+		else if (argument == "--density" && hasValue)
+			options.density = std::max((float)atof(argv[++i]), 0.01f);
+		else if (argument == "--maxneighbours" && hasValue)
+			options.maxNeighbours = (unsigned)atoi(argv[++i]);
+		else if (argument == "--skin" && hasValue)
+			options.skin = std::max((float)atof(argv[++i]), 0.0f);
+		else if (argument == "--noincremental")
+			options.incremental = false;
+		else if (argument == "--nosimd")
+			options.useSimd = false;
+		else if (argument == "--nofarfield")
+			options.farField = false;
+		else if (argument == "--format" && hasValue)
+			options.csv = std::string(argv[++i]) == "csv";
+		else if (argument == "--check")
+			options.check = true;
+		else
+		{
+			fprintf(stderr, "Unknown argument %s\n", argument.c_str());
+			return 1;
+		}
+	}
+	if (options.threads.empty() || std::find(options.threads.begin(), options.threads.end(), 1u) == options.threads.end())
+		options.threads.insert(options.threads.begin(), 1u);
+	if (options.check)
+		return RunChecks(options) ? 0 : 1;
+
+	const float timeStep = 1.0f / 60.0f;
+	std::vector<BenchResult> results;
+	for (size_t s = 0; s < options.sizes.size(); s++)
+	{
+		unsigned numBoids = options.sizes[s];
+		if (numBoids == 0)
+			continue;
+		FlockParams params;
+		FlockIndexSettings indexSettings;
+		float halfSize = SetUpTank(numBoids, options, params, indexSettings);
+
+		for (size_t d = 0; d < options.distributions.size(); d++)
+		{
+			const std::string& distribution = options.distributions[d];
+			fprintf(stderr, "%u boids, %s\n", numBoids, distribution.c_str());
+			FlockState initial;
+			Populate(initial, numBoids, distribution, halfSize);
+			//the build phase rebuilds the same flock, which the incremental grid would find nothing to do for
+			FlockIndexSettings fullSettings = indexSettings;
+			fullSettings.incremental = false;
+
+			for (size_t x = 0; x < options.indices.size(); x++)
+			{
+				FlockIndexType type = ParseFlockIndexType(options.indices[x].c_str());
+				if (type == MAX_FLOCK_INDEX_TYPES)
+				{
+					fprintf(stderr, "Unknown index %s\n", options.indices[x].c_str());
+					continue;
+				}
+				if (type == FLOCK_INDEX_AUTO)
+					type = ChooseFlockIndex(initial, indexSettings, params.maxNeighbours);
+				std::string indexName = GetFlockIndexName(type);
+				if (options.indices[x] == "auto")
+					indexName = "auto:" + indexName;
+				std::unique_ptr<FlockIndex> index = CreateFlockIndex(type, indexSettings);
+
+				//the index build is serial, it is timed once
+				std::unique_ptr<FlockIndex> fullIndex = CreateFlockIndex(type, fullSettings);
+				double buildTime = TimeMedian(options.repeat, [&]() { fullIndex->Build(initial); });
+				fullIndex.reset();
+				index->Build(initial);
+				BenchResult build;
+				build.phase = "index_build";
+				build.distribution = distribution;
+				build.index = indexName;
+				build.boids = numBoids;
+				build.threads = 1;
+				build.nsPerBoid = buildTime * 1e9 / numBoids;
+				build.efficiency = 1.0;
+				build.neighboursPerBoid = 0.0;
+				results.push_back(build);
+
+				std::vector<unsigned> counts(numBoids);
+				double neighbours = 0.0;
+				double singleThread[4] = { 0.0, 0.0, 0.0, 0.0 };
+				for (size_t t = 0; t < options.threads.size(); t++)
+				{
+					unsigned numThreads = std::max(options.threads[t], 1u);
+					FlockState state = initial;
+					double times[4];
+					times[0] = TimeMedian(options.repeat, [&]() {
+						RunParallel(numBoids, numThreads, [&](unsigned begin, unsigned end) {
+							std::vector<FlockRun> runs;
+							for (unsigned i = begin; i < end; i++)
+							{
+								NeighbourCount count(*index, state.px[i], state.py[i], state.pz[i], params.rangeAttract);
+								index->ForEachNeighbour(state.px[i], state.py[i], state.pz[i], params.searchRadius,
+									params.maxNeighbours, runs, count);
+								counts[i] = count.count_;
+							}
+						});
+					});
+					times[1] = TimeMedian(options.repeat, [&]() {
+						RunParallel(numBoids, numThreads, [&](unsigned begin, unsigned end) {
+							ComputeFlockForces(state, *index, params, begin, end);
+						});
+					});
+					//integration moves the flock, every run starts again from the initial state
+					times[2] = TimeMedian(options.repeat, [&]() {
+						RunParallel(numBoids, numThreads, [&](unsigned begin, unsigned end) {
+							std::copy(initial.px.begin() + begin, initial.px.begin() + end, state.px.begin() + begin);
+							std::copy(initial.pz.begin() + begin, initial.pz.begin() + end, state.pz.begin() + begin);
+							IntegrateFlock(state, params, timeStep, begin, end);
+						});
+					});
+					//whole steps from the initial state: index upkeep, forces and integration. The Verlet lists are
+					//reused until the drift passes half the skin, without a skin, or on the grids which ignore it as
+					//the game does, the index is built every step
+					bool useLists = options.skin > 0.0f && index->FiltersRuns();
+					FlockVerletLists lists;
+					lists.SetSkin(options.skin);
+					unsigned rebuilds = 0;
+					times[3] = TimeMedian(options.repeat, [&]() {
+						FlockState stepState = initial;
+						rebuilds = 0;
+						for (unsigned step = 0; step < BENCH_STEPS; step++)
+						{
+							bool rebuild = step == 0 || !useLists;
+							if (!rebuild)
+							{
+								index->Refresh(stepState);
+								rebuild = index->GetDrift() > lists.GetRebuildDrift();
+							}
+							if (rebuild)
+							{
+								index->Build(stepState);
+								lists.Invalidate(numBoids);
+								rebuilds++;
+							}
+							RunParallel(numBoids, numThreads, [&](unsigned begin, unsigned end) {
+								if (useLists)
+									ComputeFlockForces(stepState, *index, lists, params, begin, end);
+								else
+									ComputeFlockForces(stepState, *index, params, begin, end);
+							});
+							RunParallel(numBoids, numThreads, [&](unsigned begin, unsigned end) {
+								IntegrateFlock(stepState, params, timeStep, begin, end);
+							});
+						}
+					}) / BENCH_STEPS;
+					fprintf(stderr, "  %s, %u threads: index built on %u of %u steps\n", indexName.c_str(), numThreads,
+						rebuilds, BENCH_STEPS);
+					//the other phases expect the index of the initial state
+					index->Build(initial);
+					if (t == 0)
+					{
+						double total = 0.0;
+						for (unsigned i = 0; i < numBoids; i++)
+							total += counts[i];
+						neighbours = total / numBoids;
+					}
+
+					static const char* phases[4] = { "neighbour_search", "forces", "integrate", "step" };
+					for (unsigned p = 0; p < 4; p++)
+					{
+						if (numThreads == 1)
+							singleThread[p] = times[p];
+						BenchResult result;
+						result.phase = phases[p];
+						result.distribution = distribution;
+						result.index = indexName;
+						result.boids = numBoids;
+						result.threads = numThreads;
+						result.nsPerBoid = times[p] * 1e9 / numBoids;
+						result.efficiency = singleThread[p] > 0.0 ? singleThread[p] / (times[p] * numThreads) : 1.0;
+						result.neighboursPerBoid = p < 2 ? neighbours : 0.0;
+						results.push_back(result);
+					}
+				}
+			}
+		}
+	}
+
+	PrintResults(results, options);
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include "FlockGrid.h"
+#include "FlockState.h"
+
+#include <cstdlib>
+
+FlockGrid::FlockGrid() :
+	incremental_(FlockIndexSettings().incremental)
+{
+	FlockIndexSettings settings;
+	Configure(settings.cellSize, settings.minX, settings.minY, settings.minZ, settings.maxX, settings.maxY, settings.maxZ);
+}
+
+FlockGrid::FlockGrid(const FlockIndexSettings& settings) :
+	incremental_(settings.incremental)
+{
+	Configure(settings.cellSize, settings.minX, settings.minY, settings.minZ, settings.maxX, settings.maxY, settings.maxZ);
+}
+
+void FlockGrid::Configure(float cellSize, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+{
+	cellSize_ = cellSize;
+	invCellSize_ = 1.0f / cellSize;
+	minX_ = minX;
+	minY_ = minY;
+	minZ_ = minZ;
+	dimX_ = std::max((int)ceilf((maxX - minX) * invCellSize_), 1);
+	dimY_ = std::max((int)ceilf((maxY - minY) * invCellSize_), 1);
+	dimZ_ = std::max((int)ceilf((maxZ - minZ) * invCellSize_), 1);
+	cellStart_.resize(dimX_ * dimY_ * dimZ_ + 1);
+	cellCursor_.resize(dimX_ * dimY_ * dimZ_);
+	rowSums_.resize(dimY_ * dimZ_ * (dimX_ + 1));
+	//the cells of the last build mean nothing in the new layout
+	boidCell_.clear();
+}
+
+int FlockGrid::CellIndex(float x, float y, float z) const
+{
+	int cx = std::min(std::max(CellX(x), 0), dimX_ - 1);
+	int cy = std::min(std::max(CellY(y), 0), dimY_ - 1);
+	int cz = std::min(std::max(CellZ(z), 0), dimZ_ - 1);
+	return (cz * dimY_ + cy) * dimX_ + cx;
+}
+
+void FlockGrid::Build(const FlockState& state)
+{
+	//the cells of every boid now, which either path starts from
+	unsigned numBoids = state.Size();
+	newCell_.resize(numBoids);
+	for (unsigned i = 0; i < numBoids; i++)
+		newCell_[i] = CellIndex(state.px[i], state.py[i], state.pz[i]);
+
+	if (!incremental_ || !MoveChanged())
+		Sort();
+	CopySorted(state);
+	UpdateAggregates();
+}
+
+void FlockGrid::Sort()
+{
+	unsigned numBoids = (unsigned)newCell_.size();
+	unsigned numCells = (unsigned)cellCursor_.size();
+	boidCell_.swap(newCell_);
+	boidSlot_.resize(numBoids);
+
+	//count boids per cell
+	for (unsigned c = 0; c < numCells; c++)
+		cellCursor_[c] = 0;
+	for (unsigned i = 0; i < numBoids; i++)
+		cellCursor_[boidCell_[i]]++;
+
+	//exclusive prefix sum gives the first slot of every cell
+	unsigned total = 0;
+	for (unsigned c = 0; c < numCells; c++)
+	{
+		unsigned count = cellCursor_[c];
+		cellStart_[c] = total;
+		cellCursor_[c] = total;
+		total += count;
+	}
+	cellStart_[numCells] = total;
+
+	//scatter indices
+	sortedIndex_.resize(total);
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		unsigned slot = cellCursor_[boidCell_[i]]++;
+		sortedIndex_[slot] = i;
+		boidSlot_[i] = slot;
+	}
+}
+
+bool FlockGrid::MoveChanged()
+{
+	unsigned numBoids = (unsigned)newCell_.size();
+	if (numBoids != boidCell_.size())
+		return false;
+
+	//a move shifts every cell boundary and every slot between the boid's old place and its new one. Past about half
+	//the boids and cells a sort touches, when many boids left their cell or crossed many rows, the sort is cheaper
+	size_t budget = (numBoids + cellCursor_.size()) / 2;
+	size_t work = 0;
+	moved_.clear();
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		int from = boidCell_[i];
+		int to = newCell_[i];
+		if (to == from)
+			continue;
+		work += std::abs(to - from) + std::abs((int)cellStart_[to] - (int)cellStart_[from]);
+		if (work > budget)
+			return false;
+		moved_.push_back(i);
+	}
+
+	for (size_t m = 0; m < moved_.size(); m++)
+	{
+		unsigned boid = moved_[m];
+		MoveBoid(boid, boidCell_[boid], newCell_[boid]);
+		boidCell_[boid] = newCell_[boid];
+	}
+	return true;
+}
+
+void FlockGrid::MoveBoid(unsigned boid, int from, int to)
+{
+	//the boid is taken out of its slot and put back in its new cell in flock state order, where the sort would
+	//put it, and the slots and cell boundaries in between shift one slot towards the gap. Boids in a cell therefore
+	//always sit in flock state order, and the force sums come out the same as after a sort
+	unsigned slot = boidSlot_[boid];
+	unsigned* cellBegin = &sortedIndex_[0] + cellStart_[to];
+	unsigned* cellEnd = &sortedIndex_[0] + cellStart_[to + 1];
+	unsigned target = (unsigned)(std::lower_bound(cellBegin, cellEnd, boid) - &sortedIndex_[0]);
+	if (from < to)
+	{
+		//slots (slot, target) shift down, the boid goes in just before target
+		target--;
+		for (unsigned s = slot; s < target; s++)
+		{
+			sortedIndex_[s] = sortedIndex_[s + 1];
+			boidSlot_[sortedIndex_[s]] = s;
+		}
+		for (int c = from + 1; c <= to; c++)
+			cellStart_[c]--;
+	}
+	else
+	{
+		//slots [target, slot) shift up, the boid goes in at target
+		for (unsigned s = slot; s > target; s--)
+		{
+			sortedIndex_[s] = sortedIndex_[s - 1];
+			boidSlot_[sortedIndex_[s]] = s;
+		}
+		for (int c = to + 1; c <= from; c++)
+			cellStart_[c]++;
+	}
+	sortedIndex_[target] = boid;
+	boidSlot_[boid] = target;
+}
+
+void FlockGrid::UpdateAggregates()
+{
+	//cells along a row are back to back in the slots, so one pass over them makes its running sums
+	unsigned numRows = dimY_ * dimZ_;
+	for (unsigned r = 0; r < numRows; r++)
+	{
+		FlockAggregate* row = &rowSums_[r * (dimX_ + 1)];
+		const unsigned* start = &cellStart_[r * dimX_];
+		row[0] = FlockAggregate();
+		for (int cx = 0; cx < dimX_; cx++)
+		{
+			row[cx + 1] = row[cx];
+			AddAggregate(row[cx + 1], SumSlots(start[cx], start[cx + 1]));
+		}
+	}
+}
+
+void FlockGrid::GatherRuns(float x, float y, float z, float radius, unsigned /*maxSlots*/, std::vector<FlockRun>& runs) const
+{
+	//clamped like CellIndex, a sphere beyond the extents looks in the border cells
+	int minX = std::min(std::max(CellX(x - radius), 0), dimX_ - 1);
+	int maxX = std::min(std::max(CellX(x + radius), 0), dimX_ - 1);
+	int minY = std::min(std::max(CellY(y - radius), 0), dimY_ - 1);
+	int maxY = std::min(std::max(CellY(y + radius), 0), dimY_ - 1);
+	int minZ = std::min(std::max(CellZ(z - radius), 0), dimZ_ - 1);
+	int maxZ = std::min(std::max(CellZ(z + radius), 0), dimZ_ - 1);
+	//cells along an X row are stored back to back, so each row is one run of slots
+	for (int cz = minZ; cz <= maxZ; cz++)
+	{
+		for (int cy = minY; cy <= maxY; cy++)
+		{
+			int row = (cz * dimY_ + cy) * dimX_;
+			FlockRun run;
+			run.begin = cellStart_[row + minX];
+			run.end = cellStart_[row + maxX + 1];
+			if (run.begin < run.end)
+				runs.push_back(run);
+		}
+	}
+}
+
+//add the cells [begin, end] of a row of running sums
+static inline void AddSpan(FlockAggregate& sum, const FlockAggregate* row, int begin, int end)
+{
+	const FlockAggregate& first = row[begin];
+	const FlockAggregate& last = row[end + 1];
+	sum.count += last.count - first.count;
+	sum.px += last.px - first.px;
+	sum.py += last.py - first.py;
+	sum.pz += last.pz - first.pz;
+	sum.vx += last.vx - first.vx;
+	sum.vy += last.vy - first.vy;
+	sum.vz += last.vz - first.vz;
+}
+
+void FlockGrid::SumFar(float x, float y, float z, float nearRadius, float farRadius, FlockAggregate& sum) const
+{
+	//the near box is clamped exactly as GatherRuns clamps it, so no cell is both resolved and summed
+	int nearMinX = std::min(std::max(CellX(x - nearRadius), 0), dimX_ - 1);
+	int nearMaxX = std::min(std::max(CellX(x + nearRadius), 0), dimX_ - 1);
+	int nearMinY = std::min(std::max(CellY(y - nearRadius), 0), dimY_ - 1);
+	int nearMaxY = std::min(std::max(CellY(y + nearRadius), 0), dimY_ - 1);
+	int nearMinZ = std::min(std::max(CellZ(z - nearRadius), 0), dimZ_ - 1);
+	int nearMaxZ = std::min(std::max(CellZ(z + nearRadius), 0), dimZ_ - 1);
+	int minY = std::max(CellY(y - farRadius), 0);
+	int maxY = std::min(CellY(y + farRadius), dimY_ - 1);
+	int minZ = std::max(CellZ(z - farRadius), 0);
+	int maxZ = std::min(CellZ(z + farRadius), dimZ_ - 1);
+	float farSq = farRadius * farRadius;
+	for (int cz = minZ; cz <= maxZ; cz++)
+	{
+		float dz = minZ_ + (cz + 0.5f) * cellSize_ - z;
+		for (int cy = minY; cy <= maxY; cy++)
+		{
+			float dy = minY_ + (cy + 0.5f) * cellSize_ - y;
+			float chordSq = farSq - dy * dy - dz * dz;
+			if (chordSq < 0.0f)
+				continue;
+			//cells of the row whose centre is within the chord of the sphere
+			float chord = sqrtf(chordSq);
+			int begin = std::max((int)ceilf((x - chord - minX_) * invCellSize_ - 0.5f), 0);
+			int end = std::min((int)floorf((x + chord - minX_) * invCellSize_ - 0.5f), dimX_ - 1);
+			const FlockAggregate* row = &rowSums_[(cz * dimY_ + cy) * (dimX_ + 1)];
+			if (cz < nearMinZ || cz > nearMaxZ || cy < nearMinY || cy > nearMaxY)
+			{
+				if (begin <= end)
+					AddSpan(sum, row, begin, end);
+				continue;
+			}
+			//rows through the near box are summed either side of it
+			if (begin <= std::min(end, nearMinX - 1))
+				AddSpan(sum, row, begin, std::min(end, nearMinX - 1));
+			if (std::max(begin, nearMaxX + 1) <= end)
+				AddSpan(sum, row, std::max(begin, nearMaxX + 1), end);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "FlockIndex.h"
+
+#include <cmath>
+
+/// Uniform 3D grid over the tank. Boids are bucketed into one flat index array ordered by cell, and their positions
+/// and velocities are copied in the same order so every cell, and every run of cells along an X row, is a contiguous
+/// block of memory. Most boids stay in their cell from one step to the next, so a build only moves the ones that
+/// left it, and sorts from scratch with a counting sort when too many did. Either way the boids of a cell are in flock
+/// state order, so the slots only depend on the state and not on earlier builds.
+class FlockGrid : public FlockIndex
+{
+public:
+	/// Construct with the default 10 unit cells over the [-100, 100) tank and the water column of the settings.
+	FlockGrid();
+	/// Construct with the cell size and extents of the settings.
+	explicit FlockGrid(const FlockIndexSettings& settings);
+
+	/// Set cell size and world extents. Boids outside the extents go into the nearest border cell, so they still
+	/// find each other, but a crowd of them there makes those cells expensive.
+	void Configure(float cellSize, float minX, float minY, float minZ, float maxX, float maxY, float maxZ);
+	/// Rebuild from the flock state. The boids that changed cell since the last build are moved, or every boid is
+	/// sorted again when the flock size changed or moving them would cost more.
+	virtual void Build(const FlockState& state);
+	/// Append one run per X row of cells the box around the sphere covers.
+	virtual void GatherRuns(float x, float y, float z, float radius, unsigned maxSlots, std::vector<FlockRun>& runs) const;
+	/// Add up the cells whose centre is in the far sphere, less the box GatherRuns covers around the near one. Each
+	/// X row of the sphere is one difference of the row's running sums.
+	virtual void SumFar(float x, float y, float z, float nearRadius, float farRadius, FlockAggregate& sum) const;
+	virtual FlockIndexType GetType() const { return FLOCK_INDEX_GRID; }
+
+	/// Return the cell column of a world X coordinate, may be outside [0, dimX).
+	int CellX(float x) const { return (int)floorf((x - minX_) * invCellSize_); }
+	/// Return the cell layer of a world Y coordinate, may be outside [0, dimY).
+	int CellY(float y) const { return (int)floorf((y - minY_) * invCellSize_); }
+	/// Return the cell row of a world Z coordinate, may be outside [0, dimZ).
+	int CellZ(float z) const { return (int)floorf((z - minZ_) * invCellSize_); }
+	/// Return the flat index of the cell holding a position, border cells hold everything beyond them.
+	int CellIndex(float x, float y, float z) const;
+
+	/// Cell size in world units.
+	float cellSize_;
+	/// World position of the grid corner.
+	float minX_, minY_, minZ_;
+	/// Number of cells along X, Y and Z.
+	int dimX_, dimY_, dimZ_;
+	/// First sorted slot of each cell, cellStart_[c + 1] is one past the last slot of cell c.
+	std::vector<unsigned> cellStart_;
+	/// Running sums of the cell aggregates along each X row, dimX + 1 per row. Entry x of a row holds its cells
+	/// before x, so a span of cells is the difference of two entries.
+	std::vector<FlockAggregate> rowSums_;
+
+protected:
+	/// Running sums of every row from its cells.
+	virtual void UpdateAggregates();
+
+private:
+	/// Sort every boid into its cell of newCell_: count per cell, prefix sum, scatter.
+	void Sort();
+	/// Move the boids whose cell of newCell_ differs from the last build, return false without touching the grid when
+	/// that would cost more than a sort.
+	bool MoveChanged();
+	/// Move a boid along the sorted slots into its place in another cell.
+	void MoveBoid(unsigned boid, int from, int to);
+
+	float invCellSize_;
+	/// Move only the boids that changed cell.
+	bool incremental_;
+	/// Cell of each boid in flock state order, as of the last build.
+	std::vector<int> boidCell_;
+	/// Sorted slot of each boid in flock state order.
+	std::vector<unsigned> boidSlot_;
+	/// Scatter cursor per cell, reused between builds.
+	std::vector<unsigned> cellCursor_;
+	/// Cell of each boid in flock state order as of this build, reused between builds.
+	std::vector<int> newCell_;
+	/// Boids that changed cell, reused between builds.
+	std::vector<unsigned> moved_;
+};
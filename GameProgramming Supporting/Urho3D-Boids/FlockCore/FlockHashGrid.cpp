@@ -0,0 +1,105 @@
+#include "FlockHashGrid.h"
+#include "FlockState.h"
+
+//smallest table, so a handful of boids do not all share a few buckets
+static const unsigned MIN_BUCKETS = 64;
+
+FlockHashGrid::FlockHashGrid(const FlockIndexSettings& settings) :
+	cellSize_(settings.cellSize),
+	invCellSize_(1.0f / settings.cellSize),
+	bucketMask_(MIN_BUCKETS - 1)
+{
+}
+
+unsigned FlockHashGrid::Bucket(int cx, int cy, int cz) const
+{
+	//the low bits of a product only depend on the low bits of the cell, so mix the high ones back down
+	unsigned h = (unsigned)cx * 0x9e3779b1u ^ (unsigned)cy * 0xc2b2ae3du ^ (unsigned)cz * 0x85ebca77u;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h & bucketMask_;
+}
+
+void FlockHashGrid::Build(const FlockState& state)
+{
+	unsigned numBoids = state.Size();
+	//keep the load under a half so most buckets hold a single cell
+	unsigned numBuckets = MIN_BUCKETS;
+	while (numBuckets < numBoids * 2)
+		numBuckets *= 2;
+	bucketMask_ = numBuckets - 1;
+	bucketStart_.resize(numBuckets + 1);
+	bucketCursor_.resize(numBuckets);
+	boidBucket_.resize(numBoids);
+
+	//count boids per bucket
+	for (unsigned b = 0; b < numBuckets; b++)
+		bucketCursor_[b] = 0;
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		unsigned bucket = Bucket(Cell(state.px[i]), Cell(state.py[i]), Cell(state.pz[i]));
+		boidBucket_[i] = bucket;
+		bucketCursor_[bucket]++;
+	}
+
+	//exclusive prefix sum gives the first slot of every bucket
+	unsigned total = 0;
+	for (unsigned b = 0; b < numBuckets; b++)
+	{
+		unsigned count = bucketCursor_[b];
+		bucketStart_[b] = total;
+		bucketCursor_[b] = total;
+		total += count;
+	}
+	bucketStart_[numBuckets] = total;
+
+	sortedIndex_.resize(total);
+	for (unsigned i = 0; i < numBoids; i++)
+		sortedIndex_[bucketCursor_[boidBucket_[i]]++] = i;
+	CopySorted(state);
+}
+
+void FlockHashGrid::GatherRuns(float x, float y, float z, float radius, unsigned /*maxSlots*/, std::vector<FlockRun>& runs) const
+{
+	if (bucketStart_.empty())
+		return;
+	int minX = Cell(x - radius);
+	int maxX = Cell(x + radius);
+	int minY = Cell(y - radius);
+	int maxY = Cell(y + radius);
+	int minZ = Cell(z - radius);
+	int maxZ = Cell(z + radius);
+	//a box wider than the table would visit every bucket anyway
+	if ((unsigned)(maxX - minX + 1) * (unsigned)(maxY - minY + 1) * (unsigned)(maxZ - minZ + 1) > bucketMask_)
+	{
+		FlockRun run;
+		run.begin = 0;
+		run.end = GetNumSorted();
+		runs.push_back(run);
+		return;
+	}
+
+	//two cells of the box may share a bucket, the repeat is dropped so no boid is counted twice
+	size_t first = runs.size();
+	for (int cz = minZ; cz <= maxZ; cz++)
+	{
+		for (int cy = minY; cy <= maxY; cy++)
+		{
+			for (int cx = minX; cx <= maxX; cx++)
+			{
+				unsigned bucket = Bucket(cx, cy, cz);
+				FlockRun run;
+				run.begin = bucketStart_[bucket];
+				run.end = bucketStart_[bucket + 1];
+				if (run.begin == run.end)
+					continue;
+				size_t r = first;
+				while (r < runs.size() && runs[r].begin != run.begin)
+					r++;
+				if (r == runs.size())
+					runs.push_back(run);
+			}
+		}
+	}
+}
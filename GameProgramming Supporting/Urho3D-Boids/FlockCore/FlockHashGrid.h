@@ -0,0 +1,40 @@
+#pragma once
+
+#include "FlockIndex.h"
+
+#include <cmath>
+
+/// Uniform 3D cells of unbounded extent, hashed into a table of buckets about twice the flock size and rebuilt
+/// every step with a counting sort by bucket. Memory follows the number of boids rather than the tank area, and
+/// a boid anywhere is found by its neighbours. Cells that share a bucket are told apart by the distance tests.
+class FlockHashGrid : public FlockIndex
+{
+public:
+	/// Construct with the cell size of the settings.
+	explicit FlockHashGrid(const FlockIndexSettings& settings);
+
+	/// Rebuild from the flock state: size the table, count per bucket, prefix sum, scatter.
+	virtual void Build(const FlockState& state);
+	/// Append the bucket of every cell the box around the sphere covers, each bucket once.
+	virtual void GatherRuns(float x, float y, float z, float radius, unsigned maxSlots, std::vector<FlockRun>& runs) const;
+	virtual FlockIndexType GetType() const { return FLOCK_INDEX_HASHED; }
+
+	/// Return the cell column, layer or row of a world coordinate.
+	int Cell(float coordinate) const { return (int)floorf(coordinate * invCellSize_); }
+	/// Return the bucket of a cell.
+	unsigned Bucket(int cx, int cy, int cz) const;
+
+	/// Cell size in world units.
+	float cellSize_;
+	/// First sorted slot of each bucket, bucketStart_[b + 1] is one past the last slot of bucket b.
+	std::vector<unsigned> bucketStart_;
+
+private:
+	float invCellSize_;
+	/// Number of buckets minus one, the table size is a power of two.
+	unsigned bucketMask_;
+	/// Bucket of each boid in flock state order.
+	std::vector<unsigned> boidBucket_;
+	/// Scatter cursor per bucket, reused between builds.
+	std::vector<unsigned> bucketCursor_;
+};
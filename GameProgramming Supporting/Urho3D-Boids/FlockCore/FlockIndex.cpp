@@ -0,0 +1,165 @@
+#include "FlockIndex.h"
+#include "FlockGrid.h"
+#include "FlockHashGrid.h"
+#include "FlockState.h"
+#include "FlockTree.h"
+
+#include <cmath>
+#include <cstring>
+
+static const char* indexNames[MAX_FLOCK_INDEX_TYPES] =
+{
+	"auto",
+	"grid",
+	"hashed",
+	"kdtree",
+	"octree"
+};
+
+void FlockIndex::CopySorted(const FlockState& state)
+{
+	unsigned total = (unsigned)sortedIndex_.size();
+	px_.resize(total);
+	py_.resize(total);
+	pz_.resize(total);
+	vx_.resize(total);
+	vy_.resize(total);
+	vz_.resize(total);
+	for (unsigned slot = 0; slot < total; slot++)
+	{
+		unsigned i = sortedIndex_[slot];
+		px_[slot] = state.px[i];
+		py_[slot] = state.py[i];
+		pz_[slot] = state.pz[i];
+		vx_[slot] = state.vx[i];
+		vy_[slot] = state.vy[i];
+		vz_[slot] = state.vz[i];
+	}
+	builtX_ = px_;
+	builtY_ = py_;
+	builtZ_ = pz_;
+	drift_ = 0.0f;
+}
+
+void FlockIndex::Refresh(const FlockState& state)
+{
+	unsigned total = (unsigned)sortedIndex_.size();
+	float driftSq = 0.0f;
+	for (unsigned slot = 0; slot < total; slot++)
+	{
+		unsigned i = sortedIndex_[slot];
+		px_[slot] = state.px[i];
+		py_[slot] = state.py[i];
+		pz_[slot] = state.pz[i];
+		vx_[slot] = state.vx[i];
+		vy_[slot] = state.vy[i];
+		vz_[slot] = state.vz[i];
+		float dx = px_[slot] - builtX_[slot];
+		float dy = py_[slot] - builtY_[slot];
+		float dz = pz_[slot] - builtZ_[slot];
+		driftSq = std::max(driftSq, dx * dx + dy * dy + dz * dz);
+	}
+	drift_ = sqrtf(driftSq);
+	UpdateAggregates();
+}
+
+void FlockIndex::FilterRuns(float x, float y, float z, float radius, const std::vector<FlockRun>& /*candidates*/,
+	std::vector<FlockRun>& runs) const
+{
+	GatherRuns(x, y, z, radius, 0, runs);
+}
+
+void FlockIndex::MergeRuns(std::vector<FlockRun>& runs, size_t first)
+{
+	if (runs.size() - first < 2)
+		return;
+	size_t last = first;
+	for (size_t r = first + 1; r < runs.size(); r++)
+	{
+		if (runs[r].begin == runs[last].end)
+			runs[last].end = runs[r].end;
+		else
+			runs[++last] = runs[r];
+	}
+	runs.resize(last + 1);
+}
+
+FlockAggregate FlockIndex::SumSlots(unsigned begin, unsigned end) const
+{
+	FlockAggregate sum = FlockAggregate();
+	sum.count = end - begin;
+	for (unsigned slot = begin; slot < end; slot++)
+	{
+		sum.px += px_[slot];
+		sum.py += py_[slot];
+		sum.pz += pz_[slot];
+		sum.vx += vx_[slot];
+		sum.vy += vy_[slot];
+		sum.vz += vz_[slot];
+	}
+	return sum;
+}
+
+std::unique_ptr<FlockIndex> CreateFlockIndex(FlockIndexType type, const FlockIndexSettings& settings)
+{
+	switch (type)
+	{
+	case FLOCK_INDEX_HASHED:
+		return std::unique_ptr<FlockIndex>(new FlockHashGrid(settings));
+	case FLOCK_INDEX_KDTREE:
+		return std::unique_ptr<FlockIndex>(new FlockKdTree(settings));
+	case FLOCK_INDEX_OCTREE:
+		return std::unique_ptr<FlockIndex>(new FlockOctree(settings));
+	default:
+		return std::unique_ptr<FlockIndex>(new FlockGrid(settings));
+	}
+}
+
+FlockIndexType ChooseFlockIndex(const FlockState& state, const FlockIndexSettings& settings, unsigned maxNeighbours)
+{
+	unsigned numBoids = state.Size();
+	if (!numBoids)
+		return FLOCK_INDEX_GRID;
+
+	//count boids per cell of the uniform grid, and the ones it would have to pile into its border cells
+	FlockGrid grid(settings);
+	std::vector<unsigned> counts(grid.dimX_ * grid.dimY_ * grid.dimZ_, 0);
+	unsigned escaped = 0;
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		float x = state.px[i];
+		float y = state.py[i];
+		float z = state.pz[i];
+		if (x < settings.minX || x > settings.maxX || y < settings.minY || y > settings.maxY || z < settings.minZ ||
+			z > settings.maxZ)
+			escaped++;
+		counts[grid.CellIndex(x, y, z)]++;
+	}
+
+	//crowding is the cell occupancy a boid sees on average, sum of count squared over the flock size.
+	//It is the grid's work per boid, and grows with clustering where the plain average does not
+	double crowding = 0.0;
+	for (size_t c = 0; c < counts.size(); c++)
+		crowding += (double)counts[c] * counts[c];
+	crowding /= numBoids;
+
+	bool crowded = crowding > (maxNeighbours ? 2.0f * maxNeighbours : FLOCK_CROWDED_OCCUPANCY);
+	if (escaped)
+		return crowded ? FLOCK_INDEX_OCTREE : FLOCK_INDEX_HASHED;
+	return crowded ? FLOCK_INDEX_KDTREE : FLOCK_INDEX_GRID;
+}
+
+const char* GetFlockIndexName(FlockIndexType type)
+{
+	return type < MAX_FLOCK_INDEX_TYPES ? indexNames[type] : "";
+}
+
+FlockIndexType ParseFlockIndexType(const char* name)
+{
+	for (unsigned i = 0; i < MAX_FLOCK_INDEX_TYPES; i++)
+	{
+		if (!strcmp(name, indexNames[i]))
+			return (FlockIndexType)i;
+	}
+	return MAX_FLOCK_INDEX_TYPES;
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+struct FlockState;
+
+/// Spatial index backends the flock can run on.
+enum FlockIndexType
+{
+	/// Pick one of the others from the measured spread and crowding of the flock.
+	FLOCK_INDEX_AUTO = 0,
+	/// Uniform 3D grid over fixed extents, boids outside are kept in the border cells.
+	FLOCK_INDEX_GRID,
+	/// Uniform 3D cells hashed into a table sized by the flock, no extents at all.
+	FLOCK_INDEX_HASHED,
+	/// k-d tree with leaves of a few boids, adapts to clustered schools.
+	FLOCK_INDEX_KDTREE,
+	/// Octree over the Morton order of the boids, with node bounds fitted to the boids they hold.
+	FLOCK_INDEX_OCTREE,
+	MAX_FLOCK_INDEX_TYPES
+};
+
+/// Auto selection: average boids sharing a grid cell with a boid above which a tree backend is used. FlockBench puts
+/// the break even of the uncapped force pass at about this many.
+static const float FLOCK_CROWDED_OCCUPANCY = 200.0f;
+
+/// Build settings shared by every backend. Each uses the ones that apply to it.
+struct FlockIndexSettings
+{
+	FlockIndexSettings() :
+		type(FLOCK_INDEX_AUTO),
+		cellSize(10.0f),
+		minX(-100.0f),
+		minY(0.0f),
+		minZ(-100.0f),
+		maxX(100.0f),
+		maxY(90.0f),
+		maxZ(100.0f),
+		leafSize(64),
+		incremental(true)
+	{
+	}
+
+	FlockIndexType type;
+	//cell size of the grids
+	float cellSize;
+	//extents of the uniform grid, and of the tank the auto selection counts escaped boids against.
+	//Y defaults to the water column from the tank floor to the surface
+	float minX, minY, minZ;
+	float maxX, maxY, maxZ;
+	//most boids a tree leaf holds
+	unsigned leafSize;
+	//let the uniform grid move only the boids that changed cell since its last build
+	bool incremental;
+};
+
+/// A block of contiguous sorted slots, [begin, end).
+struct FlockRun
+{
+	unsigned begin;
+	unsigned end;
+};
+
+/// Count, position sum and velocity sum of a group of boids. Far from a boid the group steers it as one.
+struct FlockAggregate
+{
+	unsigned count;
+	float px, py, pz;
+	float vx, vy, vz;
+};
+
+/// Add the boids of one aggregate to another.
+inline void AddAggregate(FlockAggregate& sum, const FlockAggregate& add)
+{
+	sum.count += add.count;
+	sum.px += add.px;
+	sum.py += add.py;
+	sum.pz += add.pz;
+	sum.vx += add.vx;
+	sum.vy += add.vy;
+	sum.vz += add.vz;
+}
+
+/// Spatial index over a flock snapshot. Every backend reorders the boids so that nearby boids sit in
+/// contiguous sorted slots, copies their positions and velocities into that order, and answers a neighbourhood
+/// query with a short list of slot runs. The steering kernel streams the runs straight out of the sorted arrays,
+/// so it is the same whatever the backend.
+class FlockIndex
+{
+public:
+	FlockIndex() :
+		drift_(0.0f)
+	{
+	}
+	virtual ~FlockIndex() {}
+
+	/// Rebuild from the flock state. Every boid is indexed, wherever it is.
+	virtual void Build(const FlockState& state) = 0;
+	/// Copy the positions and velocities of the same boids into the slots of the last build, without sorting them
+	/// again, and measure how far they have drifted. The runs of a query still group the boids by where they were
+	/// at the build, so a query has to be widened by GetDrift() to find every boid in range.
+	void Refresh(const FlockState& state);
+	/// Append the runs holding every boid within radius of a point. Runs may hold boids further away,
+	/// every user tests the distance. The runs of one query never overlap. With maxSlots above zero the trees stop
+	/// once the runs hold that many boids, closest leaves first, which bounds the query in a packed school. The grids
+	/// ignore it.
+	virtual void GatherRuns(float x, float y, float z, float radius, unsigned maxSlots, std::vector<FlockRun>& runs) const = 0;
+	/// Append the runs an uncapped GatherRuns would append for a sphere, picked out of candidate runs an earlier query
+	/// gathered around a sphere holding this one on the same build. By default the query is made again, the grids
+	/// answer it as cheaply as they would read the candidates.
+	virtual void FilterRuns(float x, float y, float z, float radius, const std::vector<FlockRun>& candidates,
+		std::vector<FlockRun>& runs) const;
+	/// Return whether FilterRuns reads the candidates instead of querying again. Only then do Verlet lists save work.
+	virtual bool FiltersRuns() const { return false; }
+	/// Add up the boids out to farRadius that GatherRuns with nearRadius leaves out, so the two together see every
+	/// boid in range once. They are taken a group at a time, a group counting whole when its centre is in range. The
+	/// hashed grid cannot tell its cells apart and adds nothing.
+	virtual void SumFar(float /*x*/, float /*y*/, float /*z*/, float /*nearRadius*/, float /*farRadius*/,
+		FlockAggregate& /*sum*/) const {}
+	virtual FlockIndexType GetType() const = 0;
+
+	/// Return the number of boids indexed on the last build.
+	unsigned GetNumSorted() const { return (unsigned)sortedIndex_.size(); }
+	/// Return the farthest any boid has moved between the last build and the last refresh.
+	float GetDrift() const { return drift_; }
+	/// Stream every sorted slot of the runs around a point to visitor(slot). runs is scratch space owned by the caller.
+	template <class Visitor> void ForEachNeighbour(float x, float y, float z, float radius, unsigned maxSlots,
+		std::vector<FlockRun>& runs, Visitor& visitor) const;
+
+	/// Flock state index of each sorted slot.
+	std::vector<unsigned> sortedIndex_;
+	/// Positions in sorted order.
+	std::vector<float> px_, py_, pz_;
+	/// Velocities in sorted order.
+	std::vector<float> vx_, vy_, vz_;
+
+protected:
+	/// Copy positions and velocities from the state in sortedIndex_ order, and keep the positions to measure drift.
+	void CopySorted(const FlockState& state);
+	/// Sum the aggregates of the far field from the sorted slots, on every build and refresh.
+	virtual void UpdateAggregates() {}
+	/// Join the runs from first on that touch, so the kernel gets fewer, longer runs. They must be in slot order.
+	static void MergeRuns(std::vector<FlockRun>& runs, size_t first);
+	/// Return the aggregate of sorted slots [begin, end), after CopySorted.
+	FlockAggregate SumSlots(unsigned begin, unsigned end) const;
+
+	/// Positions in sorted order at the last build.
+	std::vector<float> builtX_, builtY_, builtZ_;
+	float drift_;
+};
+
+template <class Visitor> void FlockIndex::ForEachNeighbour(float x, float y, float z, float radius, unsigned maxSlots,
+	std::vector<FlockRun>& runs, Visitor& visitor) const
+{
+	runs.clear();
+	GatherRuns(x, y, z, radius, maxSlots, runs);
+	for (size_t r = 0; r < runs.size(); r++)
+	{
+		for (unsigned slot = runs[r].begin; slot < runs[r].end; slot++)
+			visitor(slot);
+	}
+}
+
+/// Create an index of a given backend. FLOCK_INDEX_AUTO creates the uniform grid until a flock has been measured.
+std::unique_ptr<FlockIndex> CreateFlockIndex(FlockIndexType type, const FlockIndexSettings& settings);
+/// Pick a backend for a flock. Boids outside the extents call for an unbounded backend, crowded cells for a tree.
+/// With a neighbour cap a tree already pays off at twice the cap, as it stops after the nearest leaves where a grid
+/// still has to look at every boid of its cells.
+FlockIndexType ChooseFlockIndex(const FlockState& state, const FlockIndexSettings& settings, unsigned maxNeighbours);
+/// Return the name of a backend as used on the command line: auto, grid, hashed, kdtree or octree.
+const char* GetFlockIndexName(FlockIndexType type);
+/// Return the backend of a name, or MAX_FLOCK_INDEX_TYPES when there is none.
+FlockIndexType ParseFlockIndexType(const char* name);
+
+/// Neighbour visitor that keeps only the k closest slots seen, in a fixed size array. Used to cap the
+/// work per boid in dense schools without allocating.
+struct NearestNeighbours
+{
+	/// Largest k supported.
+	static const unsigned MAX_K = 32;
+
+	/// Construct for the boid at a position. Slots at zero distance, the boid itself included, are skipped.
+	NearestNeighbours(const FlockIndex& index, float x, float y, float z, unsigned k) :
+		index_(index),
+		x_(x),
+		y_(y),
+		z_(z),
+		k_(std::min(k, MAX_K)),
+		count_(0),
+		farthest_(0)
+	{
+	}
+
+	void operator()(unsigned slot)
+	{
+		float dx = x_ - index_.px_[slot];
+		float dy = y_ - index_.py_[slot];
+		float dz = z_ - index_.pz_[slot];
+		float distSq = dx * dx + dy * dy + dz * dz;
+		if (distSq <= 0.0f)
+			return;
+		if (count_ < k_)
+		{
+			slots_[count_] = slot;
+			distSq_[count_] = distSq;
+			if (distSq > distSq_[farthest_])
+				farthest_ = count_;
+			count_++;
+			return;
+		}
+		if (distSq >= distSq_[farthest_])
+			return;
+		//replace the farthest kept slot and find the new farthest
+		slots_[farthest_] = slot;
+		distSq_[farthest_] = distSq;
+		for (unsigned i = 0; i < count_; i++)
+		{
+			if (distSq_[i] > distSq_[farthest_])
+				farthest_ = i;
+		}
+	}
+
+	const FlockIndex& index_;
+	float x_, y_, z_;
+	unsigned k_;
+	unsigned count_;
+	unsigned farthest_;
+	unsigned slots_[MAX_K];
+	float distSq_[MAX_K];
+};
@@ -0,0 +1,343 @@
+#include "FlockRules.h"
+#include "FlockIndex.h"
+#include "FlockState.h"
+#include "FlockVerlet.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef FLOCK_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef FLOCK_SSE
+static inline float HorizontalSum(__m128 v)
+{
+	float lanes[4];
+	_mm_storeu_ps(lanes, v);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+//running sums of the three steering rules for one boid, fed one neighbour slot or one run of slots at a time.
+//ranges are compared squared, the square root is only taken for separation
+struct SteeringSum
+{
+	SteeringSum(const FlockIndex& index, float x, float y, float z, float rangeAttract, float rangeAlign, float rangeRepel, bool useSimd) :
+		index_(index),
+		x_(x),
+		y_(y),
+		z_(z),
+		AttractSq(rangeAttract * rangeAttract),
+		AlignSq(rangeAlign * rangeAlign),
+		RepelSq(rangeRepel * rangeRepel),
+		UseSimd(useSimd),
+		PmeanX(0.0f), PmeanY(0.0f), PmeanZ(0.0f),
+		VmeanX(0.0f), VmeanY(0.0f), VmeanZ(0.0f),
+		FSx(0.0f), FSy(0.0f), FSz(0.0f),
+		Pn(0),
+		Vn(0)
+	{
+	}
+
+	void operator()(unsigned Slot)
+	{
+		//sep = vector position of this boid from current boid
+		float sepX = x_ - index_.px_[Slot];
+		float sepY = y_ - index_.py_[Slot];
+		float sepZ = z_ - index_.pz_[Slot];
+		float d2 = sepX * sepX + sepY * sepY + sepZ * sepZ;
+		//the boid itself and coincident boids have no direction to push apart in
+		if (d2 <= 0.0f) return;
+		if (d2 < AttractSq)
+		{
+			//with range,so is a neighbour
+			PmeanX += index_.px_[Slot];
+			PmeanY += index_.py_[Slot];
+			PmeanZ += index_.pz_[Slot];
+			Pn++;
+		}
+
+		if (d2 < AlignSq)
+		{
+			//with range,so is a neighbour
+			VmeanX += index_.vx_[Slot];
+			VmeanY += index_.vy_[Slot];
+			VmeanZ += index_.vz_[Slot];
+			Vn++;
+		}
+		if (d2 < RepelSq)
+		{
+			float d = sqrtf(d2);
+			FSx += sepX / d;
+			FSy += sepY / d;
+			FSz += sepZ / d;
+		}
+	}
+
+	void operator()(unsigned Begin, unsigned End)
+	{
+		unsigned Slot = Begin;
+#ifdef FLOCK_SSE
+		if (UseSimd && End - Begin >= 4)
+		{
+			//four neighbours per iteration, every rule is a lane mask instead of a branch
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 x = _mm_set1_ps(x_);
+			const __m128 y = _mm_set1_ps(y_);
+			const __m128 z = _mm_set1_ps(z_);
+			const __m128 attractSq = _mm_set1_ps(AttractSq);
+			const __m128 alignSq = _mm_set1_ps(AlignSq);
+			const __m128 repelSq = _mm_set1_ps(RepelSq);
+			__m128 pX = zero, pY = zero, pZ = zero, pN = zero;
+			__m128 vX = zero, vY = zero, vZ = zero, vN = zero;
+			__m128 fX = zero, fY = zero, fZ = zero;
+			const float* px = &index_.px_[0];
+			const float* py = &index_.py_[0];
+			const float* pz = &index_.pz_[0];
+			const float* vx = &index_.vx_[0];
+			const float* vy = &index_.vy_[0];
+			const float* vz = &index_.vz_[0];
+			for (; Slot + 4 <= End; Slot += 4)
+			{
+				__m128 nX = _mm_loadu_ps(px + Slot);
+				__m128 nY = _mm_loadu_ps(py + Slot);
+				__m128 nZ = _mm_loadu_ps(pz + Slot);
+				__m128 sepX = _mm_sub_ps(x, nX);
+				__m128 sepY = _mm_sub_ps(y, nY);
+				__m128 sepZ = _mm_sub_ps(z, nZ);
+				__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sepX, sepX), _mm_mul_ps(sepY, sepY)), _mm_mul_ps(sepZ, sepZ));
+				__m128 valid = _mm_cmpgt_ps(d2, zero);
+
+				__m128 inAttract = _mm_and_ps(valid, _mm_cmplt_ps(d2, attractSq));
+				pX = _mm_add_ps(pX, _mm_and_ps(inAttract, nX));
+				pY = _mm_add_ps(pY, _mm_and_ps(inAttract, nY));
+				pZ = _mm_add_ps(pZ, _mm_and_ps(inAttract, nZ));
+				pN = _mm_add_ps(pN, _mm_and_ps(inAttract, one));
+
+				__m128 inAlign = _mm_and_ps(valid, _mm_cmplt_ps(d2, alignSq));
+				vX = _mm_add_ps(vX, _mm_and_ps(inAlign, _mm_loadu_ps(vx + Slot)));
+				vY = _mm_add_ps(vY, _mm_and_ps(inAlign, _mm_loadu_ps(vy + Slot)));
+				vZ = _mm_add_ps(vZ, _mm_and_ps(inAlign, _mm_loadu_ps(vz + Slot)));
+				vN = _mm_add_ps(vN, _mm_and_ps(inAlign, one));
+
+				//lanes at zero distance divide by zero here but are masked out before use
+				__m128 inRepel = _mm_and_ps(valid, _mm_cmplt_ps(d2, repelSq));
+				__m128 invD = _mm_and_ps(inRepel, _mm_div_ps(one, _mm_sqrt_ps(d2)));
+				fX = _mm_add_ps(fX, _mm_mul_ps(sepX, invD));
+				fY = _mm_add_ps(fY, _mm_mul_ps(sepY, invD));
+				fZ = _mm_add_ps(fZ, _mm_mul_ps(sepZ, invD));
+			}
+			PmeanX += HorizontalSum(pX);
+			PmeanY += HorizontalSum(pY);
+			PmeanZ += HorizontalSum(pZ);
+			Pn += (int)HorizontalSum(pN);
+			VmeanX += HorizontalSum(vX);
+			VmeanY += HorizontalSum(vY);
+			VmeanZ += HorizontalSum(vZ);
+			Vn += (int)HorizontalSum(vN);
+			FSx += HorizontalSum(fX);
+			FSy += HorizontalSum(fY);
+			FSz += HorizontalSum(fZ);
+		}
+#endif
+		//scalar fallback and the tail of the run
+		for (; Slot < End; Slot++)
+			(*this)(Slot);
+	}
+
+	const FlockIndex& index_;
+	float x_, y_, z_;
+	float AttractSq, AlignSq, RepelSq;
+	bool UseSimd;
+	float PmeanX, PmeanY, PmeanZ;
+	float VmeanX, VmeanY, VmeanZ;
+	float FSx, FSy, FSz;
+	int Pn;
+	int Vn;
+};
+
+static void ComputeForce(FlockState& state, const FlockIndex& flockIndex, FlockVerletLists* lists, unsigned index,
+	const FlockParams& params, std::vector<FlockRun>& runs)
+{
+	float px = state.px[index];
+	float py = state.py[index];
+	float pz = state.pz[index];
+	SteeringSum sum(flockIndex, px, py, pz, params.rangeAttract, params.rangeAlign, params.rangeRepel, params.useSimd);
+
+	if (params.maxNeighbours == 0)
+	{
+		//whole runs of slots go through the vector kernel. A refreshed index still groups the boids where they were
+		//at the build, so the query is widened by how far any of them has drifted since. The cached runs reach a skin
+		//further, and only the ones a query here would return are taken out of them, so the forces are the same with
+		//or without the lists
+		float nearRadius = params.searchRadius + flockIndex.GetDrift();
+		runs.clear();
+		if (lists)
+			flockIndex.FilterRuns(px, py, pz, nearRadius, lists->GetList(flockIndex, index, px, py, pz, nearRadius).runs,
+				runs);
+		else
+			flockIndex.GatherRuns(px, py, pz, nearRadius, 0, runs);
+		for (size_t r = 0; r < runs.size(); r++)
+			sum(runs[r].begin, runs[r].end);
+
+		//the rest of the cohesion and alignment ranges come from the index's cell or node aggregates, around the same
+		//near box. Separation is left to the near field, a far group is too far off to say which way it pushes
+		if (params.farField && params.rangeAttract > nearRadius)
+		{
+			FlockAggregate far = FlockAggregate();
+			flockIndex.SumFar(px, py, pz, nearRadius, params.rangeAttract, far);
+			sum.PmeanX += far.px;
+			sum.PmeanY += far.py;
+			sum.PmeanZ += far.pz;
+			sum.Pn += (int)far.count;
+		}
+		if (params.farField && params.rangeAlign > nearRadius)
+		{
+			FlockAggregate far = FlockAggregate();
+			flockIndex.SumFar(px, py, pz, nearRadius, params.rangeAlign, far);
+			sum.VmeanX += far.vx;
+			sum.VmeanY += far.vy;
+			sum.VmeanZ += far.vz;
+			sum.Vn += (int)far.count;
+		}
+	}
+	else
+	{
+		//dense schools: only the closest few steer the boid, and a tree only gathers the leaves closest to it
+		//capped queries stop at the nearest leaves, which change as the boids move, so they are never cached
+		NearestNeighbours nearest(flockIndex, px, py, pz, params.maxNeighbours);
+		flockIndex.ForEachNeighbour(px, py, pz, params.searchRadius + flockIndex.GetDrift(), params.maxNeighbours, runs,
+			nearest);
+		for (unsigned i = 0; i < nearest.count_; i++)
+			sum(nearest.slots_[i]);
+	}
+
+	float vx = state.vx[index];
+	float vy = state.vy[index];
+	float vz = state.vz[index];
+	//Seperation
+	float forceX = sum.FSx * params.repelFactor;
+	float forceY = sum.FSy * params.repelFactor;
+	float forceZ = sum.FSz * params.repelFactor;
+	//Cohension force component
+	if (sum.Pn > 0)
+	{
+		//find average position = centre of mass, and head for it at attractVmax
+		float dirX = sum.PmeanX / (float)sum.Pn - px;
+		float dirY = sum.PmeanY / (float)sum.Pn - py;
+		float dirZ = sum.PmeanZ / (float)sum.Pn - pz;
+		float length = sqrtf(dirX * dirX + dirY * dirY + dirZ * dirZ);
+		float scale = length > 0.0f ? params.attractVmax / length : 0.0f;
+		forceX += (dirX * scale - vx) * params.attractFactor;
+		forceY += (dirY * scale - vy) * params.attractFactor;
+		forceZ += (dirZ * scale - vz) * params.attractFactor;
+	}
+	//Alligment
+	if (sum.Vn > 0)
+	{
+		forceX += params.alignFactor * (sum.VmeanX / (float)sum.Vn - vx);
+		forceY += params.alignFactor * (sum.VmeanY / (float)sum.Vn - vy);
+		forceZ += params.alignFactor * (sum.VmeanZ / (float)sum.Vn - vz);
+	}
+
+	state.fx[index] = forceX;
+	state.fy[index] = forceY;
+	state.fz[index] = forceZ;
+}
+
+void ComputeFlockForces(FlockState& state, const FlockIndex& index, const FlockParams& params, unsigned begin, unsigned end)
+{
+	//run list reused by every boid of the range, a query seldom returns more than a few
+	std::vector<FlockRun> runs;
+	runs.reserve(16);
+	for (unsigned i = begin; i < end; i++)
+		ComputeForce(state, index, nullptr, i, params, runs);
+}
+
+void ComputeFlockForces(FlockState& state, const FlockIndex& index, FlockVerletLists& lists, const FlockParams& params,
+	unsigned begin, unsigned end)
+{
+	//the runs picked out of each list, and those of capped boids, which gather their own
+	std::vector<FlockRun> runs;
+	runs.reserve(16);
+	for (unsigned i = begin; i < end; i++)
+		ComputeForce(state, index, &lists, i, params, runs);
+}
+
+void IntegrateFlock(FlockState& state, const FlockParams& params, float timeStep)
+{
+	IntegrateFlock(state, params, timeStep, 0, state.Size());
+}
+
+void IntegrateFlock(FlockState& state, const FlockParams& params, float timeStep, unsigned begin, unsigned end)
+{
+	float invMass = 1.0f / BOID_MASS;
+	for (unsigned i = begin; i < end; i++)
+	{
+		//velocity first, then position from the new velocity
+		float vx = state.vx[i] + state.fx[i] * invMass * timeStep;
+		float vy = state.vy[i] + state.fy[i] * invMass * timeStep;
+		float vz = state.vz[i] + state.fz[i] * invMass * timeStep;
+		float speed = sqrtf(vx * vx + vy * vy + vz * vz);
+		if (speed > 0.0f && (speed < BOID_MIN_SPEED || speed > BOID_MAX_SPEED))
+		{
+			float scale = std::min(std::max(speed, BOID_MIN_SPEED), BOID_MAX_SPEED) / speed;
+			vx *= scale;
+			vy *= scale;
+			vz *= scale;
+		}
+		float px = state.px[i] + vx * timeStep;
+		float py = state.py[i] + vy * timeStep;
+		float pz = state.pz[i] + vz * timeStep;
+
+		//without rigid bodies the tank walls no longer stop the fish, bounce them a body length off the extents instead
+		float minX = params.minX + 1.0f, maxX = params.maxX - 1.0f;
+		float minZ = params.minZ + 1.0f, maxZ = params.maxZ - 1.0f;
+		if (px < minX || px > maxX)
+		{
+			px = std::min(std::max(px, minX), maxX);
+			vx = -vx;
+		}
+		if (pz < minZ || pz > maxZ)
+		{
+			pz = std::min(std::max(pz, minZ), maxZ);
+			vz = -vz;
+		}
+		//the floor and the surface turn them back the same way
+		if (py < BOID_MIN_Y || py > BOID_MAX_Y)
+		{
+			py = std::min(std::max(py, BOID_MIN_Y), BOID_MAX_Y);
+			vy = -vy;
+		}
+
+		state.px[i] = px;
+		state.py[i] = py;
+		state.pz[i] = pz;
+		state.vx[i] = vx;
+		state.vy[i] = vy;
+		state.vz[i] = vz;
+	}
+}
+
+void QueryFlockSphere(const FlockState& state, const FlockIndex& index, float x, float y, float z, float radius,
+	std::vector<unsigned>& result)
+{
+	std::vector<FlockRun> runs;
+	index.GatherRuns(x, y, z, radius + index.GetDrift(), 0, runs);
+	float radiusSq = radius * radius;
+	for (size_t r = 0; r < runs.size(); r++)
+	{
+		for (unsigned slot = runs[r].begin; slot < runs[r].end; slot++)
+		{
+			//test against the current state, the index copy is from before the last integration
+			unsigned i = index.sortedIndex_[slot];
+			float dx = state.px[i] - x;
+			float dy = state.py[i] - y;
+			float dz = state.pz[i] - z;
+			if (dx * dx + dy * dy + dz * dz < radiusSq)
+				result.push_back(i);
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+class FlockIndex;
+class FlockVerletLists;
+struct FlockState;
+
+//mass used by the kinematic integrator, matches the rigid body mass
+static const float BOID_MASS = 0.5f;
+//speed limits every boid is kept within
+static const float BOID_MIN_SPEED = 10.0f;
+static const float BOID_MAX_SPEED = 50.0f;
+//water column the boids swim in, a body length above the tank floor at 0 up to a body length under the surface at 90
+static const float BOID_MIN_Y = 5.0f;
+static const float BOID_MAX_Y = 85.0f;
+
+/// Tunables of the steering rules and the integrator, the same for every boid of a flock.
+struct FlockParams
+{
+	FlockParams() :
+		rangeAttract(30.0f),
+		rangeRepel(20.0f),
+		rangeAlign(5.0f),
+		searchRadius(10.0f),
+		attractVmax(5.0f),
+		attractFactor(4.0f),
+		repelFactor(2.0f),
+		alignFactor(2.0f),
+		minX(-100.0f),
+		minZ(-100.0f),
+		maxX(100.0f),
+		maxZ(100.0f),
+		maxNeighbours(0),
+		useSimd(true),
+		farField(true)
+	{
+	}
+
+	//neighbours closer than these take part in cohesion, separation and alignment
+	float rangeAttract;
+	float rangeRepel;
+	float rangeAlign;
+	//radius of the neighbourhood asked of the spatial index and resolved boid by boid, beyond it only the far field
+	//reaches
+	float searchRadius;
+	//cohesion steers towards the neighbours' centre at this speed
+	float attractVmax;
+	float attractFactor;
+	float repelFactor;
+	float alignFactor;
+	//tank the integrator bounces boids off
+	float minX, minZ;
+	float maxX, maxZ;
+	//only the closest maxNeighbours boids steer each boid, 0 uses every boid in range
+	unsigned maxNeighbours;
+	//use the SSE steering kernel when the library is built with FLOCK_SSE
+	bool useSimd;
+	//cohesion and alignment ranges beyond searchRadius are made up from the aggregates of the index's far cells or
+	//nodes, one per group instead of one per boid. Off, or with maxNeighbours, boids past searchRadius are not seen
+	bool farField;
+};
+
+/// Read phase: stream the neighbours of boids [begin, end) out of the index into their steering force. On a refreshed
+/// index the queries are widened by its drift, so every boid within searchRadius is still found. Reads only the index
+/// snapshot and writes only the forces of its own range, so ranges can run on any thread.
+void ComputeFlockForces(FlockState& state, const FlockIndex& index, const FlockParams& params, unsigned begin, unsigned end);
+/// Read phase on Verlet lists: every boid steers by the runs of its list that a query would return, the list gathered
+/// first if the index was built since. The forces are those of the plain read phase on the same index. The index has to
+/// be built or refreshed from the same state first. Each boid only touches its own list, so ranges
+/// can still run on any thread.
+void ComputeFlockForces(FlockState& state, const FlockIndex& index, FlockVerletLists& lists, const FlockParams& params,
+	unsigned begin, unsigned end);
+/// Semi-implicit Euler step of every boid, then the speed, depth and tank limits.
+void IntegrateFlock(FlockState& state, const FlockParams& params, float timeStep);
+/// Integrate boids [begin, end) only. Each boid is independent, so ranges can run on any thread.
+void IntegrateFlock(FlockState& state, const FlockParams& params, float timeStep, unsigned begin, unsigned end);
+/// Append the index of every boid within radius of a point, candidates come from the index runs around the sphere
+/// widened by its drift. Distances are against the state, which may have moved on since the index was built.
+void QueryFlockSphere(const FlockState& state, const FlockIndex& index, float x, float y, float z, float radius,
+	std::vector<unsigned>& result);
@@ -0,0 +1,42 @@
+#include "FlockState.h"
+
+void FlockState::Resize(unsigned size)
+{
+	px.resize(size);
+	py.resize(size);
+	pz.resize(size);
+	vx.resize(size);
+	vy.resize(size);
+	vz.resize(size);
+	fx.resize(size);
+	fy.resize(size);
+	fz.resize(size);
+}
+
+void FlockState::Reserve(unsigned capacity)
+{
+	px.reserve(capacity);
+	py.reserve(capacity);
+	pz.reserve(capacity);
+	vx.reserve(capacity);
+	vy.reserve(capacity);
+	vz.reserve(capacity);
+	fx.reserve(capacity);
+	fy.reserve(capacity);
+	fz.reserve(capacity);
+}
+
+void FlockState::RemoveSwap(unsigned index)
+{
+	unsigned last = Size() - 1;
+	px[index] = px[last];
+	py[index] = py[last];
+	pz[index] = pz[last];
+	vx[index] = vx[last];
+	vy[index] = vy[last];
+	vz[index] = vz[last];
+	fx[index] = fx[last];
+	fy[index] = fy[last];
+	fz[index] = fz[last];
+	Resize(last);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+/// Contiguous per-boid simulation state. The steering kernels only read and write these arrays,
+/// the engine side copies in and out of them once per step.
+struct FlockState
+{
+	//positions
+	std::vector<float> px, py, pz;
+	//velocities
+	std::vector<float> vx, vy, vz;
+	//accumulated steering force
+	std::vector<float> fx, fy, fz;
+
+	void Resize(unsigned size);
+	void Reserve(unsigned capacity);
+	//move the last slot into index and shrink by one
+	void RemoveSwap(unsigned index);
+	unsigned Size() const { return (unsigned)px.size(); }
+};
@@ -0,0 +1,372 @@
+#include "FlockTree.h"
+#include "FlockState.h"
+
+#include <cfloat>
+
+//deepest a query walk can go, the octree stops at MORTON_BITS levels and the k-d tree halves every level
+static const unsigned MAX_TREE_STACK = 128;
+//Morton bits per axis, 30 in all so a code fits the high half of a key
+static const unsigned MORTON_BITS = 10;
+//far field opening angle, a node is taken whole once its longest side is under this times its distance
+static const float FAR_THETA = 2.0f;
+
+FlockTree::FlockTree(const FlockIndexSettings& settings) :
+	leafSize_(std::max(settings.leafSize, 1u))
+{
+}
+
+unsigned FlockTree::AddNode(unsigned begin, unsigned end)
+{
+	FlockTreeNode node;
+	node.minX = node.minY = node.minZ = FLT_MAX;
+	node.maxX = node.maxY = node.maxZ = -FLT_MAX;
+	node.begin = begin;
+	node.end = end;
+	node.firstChild = 0;
+	node.numChildren = 0;
+	nodes_.push_back(node);
+	return (unsigned)nodes_.size() - 1;
+}
+
+void FlockTree::FitBounds(unsigned node, const FlockState& state)
+{
+	FlockTreeNode& n = nodes_[node];
+	for (unsigned slot = n.begin; slot < n.end; slot++)
+	{
+		unsigned i = sortedIndex_[slot];
+		n.minX = std::min(n.minX, state.px[i]);
+		n.minY = std::min(n.minY, state.py[i]);
+		n.minZ = std::min(n.minZ, state.pz[i]);
+		n.maxX = std::max(n.maxX, state.px[i]);
+		n.maxY = std::max(n.maxY, state.py[i]);
+		n.maxZ = std::max(n.maxZ, state.pz[i]);
+	}
+}
+
+//squared distance from a point to the bounds of a node, zero inside
+static inline float DistanceSq(const FlockTreeNode& node, float x, float y, float z)
+{
+	float dx = std::max(std::max(node.minX - x, x - node.maxX), 0.0f);
+	float dy = std::max(std::max(node.minY - y, y - node.maxY), 0.0f);
+	float dz = std::max(std::max(node.minZ - z, z - node.maxZ), 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+void FlockTree::UpdateAggregates()
+{
+	//backwards, so the children of a node are summed before it
+	for (size_t n = nodes_.size(); n-- > 0;)
+	{
+		FlockTreeNode& node = nodes_[n];
+		if (!node.numChildren)
+		{
+			node.sum = SumSlots(node.begin, node.end);
+			continue;
+		}
+		node.sum = nodes_[node.firstChild].sum;
+		for (unsigned c = 1; c < node.numChildren; c++)
+			AddAggregate(node.sum, nodes_[node.firstChild + c].sum);
+	}
+}
+
+void FlockTree::ListLeaves()
+{
+	leaves_.clear();
+	for (unsigned n = 0; n < nodes_.size(); n++)
+	{
+		if (!nodes_[n].numChildren)
+			leaves_.push_back(n);
+	}
+	std::sort(leaves_.begin(), leaves_.end(), [this](unsigned a, unsigned b) { return nodes_[a].begin < nodes_[b].begin; });
+}
+
+static bool RunBefore(const FlockRun& a, const FlockRun& b)
+{
+	return a.begin < b.begin;
+}
+
+void FlockTree::GatherRuns(float x, float y, float z, float radius, unsigned maxSlots, std::vector<FlockRun>& runs) const
+{
+	float radiusSq = radius * radius;
+	if (nodes_.empty() || DistanceSq(nodes_[0], x, y, z) > radiusSq)
+		return;
+	size_t first = runs.size();
+	unsigned gathered = 0;
+	unsigned stack[MAX_TREE_STACK];
+	unsigned depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0)
+	{
+		const FlockTreeNode& node = nodes_[stack[--depth]];
+		//a full stack takes the whole node, more boids to test but none missed
+		if (!node.numChildren || depth + node.numChildren > MAX_TREE_STACK)
+		{
+			FlockRun run;
+			run.begin = node.begin;
+			run.end = node.end;
+			runs.push_back(run);
+			gathered += node.end - node.begin;
+			if (maxSlots && gathered >= maxSlots)
+				break;
+			continue;
+		}
+
+		//children are tested here rather than when popped, so the ones out of reach never touch the stack
+		unsigned reach[8];
+		float reachSq[8];
+		unsigned count = 0;
+		for (unsigned c = node.numChildren; c-- > 0;)
+		{
+			float distSq = DistanceSq(nodes_[node.firstChild + c], x, y, z);
+			if (distSq > radiusSq)
+				continue;
+			//capped queries walk the nearest child next, the others in slot order, last child pushed first
+			unsigned i = count++;
+			for (; maxSlots && i > 0 && reachSq[i - 1] < distSq; i--)
+			{
+				reach[i] = reach[i - 1];
+				reachSq[i] = reachSq[i - 1];
+			}
+			reach[i] = node.firstChild + c;
+			reachSq[i] = distSq;
+		}
+		for (unsigned i = 0; i < count; i++)
+			stack[depth++] = reach[i];
+	}
+	//nearest first gathers out of slot order
+	if (maxSlots)
+		std::sort(runs.begin() + first, runs.end(), RunBefore);
+	MergeRuns(runs, first);
+}
+
+void FlockTree::FilterRuns(float x, float y, float z, float radius, const std::vector<FlockRun>& candidates,
+	std::vector<FlockRun>& runs) const
+{
+	float radiusSq = radius * radius;
+	size_t first = runs.size();
+	for (size_t r = 0; r < candidates.size(); r++)
+	{
+		//the first leaf of a candidate run is the last one starting at or before it
+		const FlockRun& candidate = candidates[r];
+		size_t leaf = std::upper_bound(leaves_.begin(), leaves_.end(), candidate.begin,
+			[this](unsigned slot, unsigned node) { return slot < nodes_[node].begin; }) - leaves_.begin();
+		for (leaf = leaf ? leaf - 1 : 0; leaf < leaves_.size(); leaf++)
+		{
+			const FlockTreeNode& node = nodes_[leaves_[leaf]];
+			if (node.begin >= candidate.end)
+				break;
+			if (DistanceSq(node, x, y, z) > radiusSq)
+				continue;
+			FlockRun run;
+			run.begin = node.begin;
+			run.end = node.end;
+			runs.push_back(run);
+		}
+	}
+	MergeRuns(runs, first);
+}
+
+void FlockTree::SumFar(float x, float y, float z, float nearRadius, float farRadius, FlockAggregate& sum) const
+{
+	float nearSq = nearRadius * nearRadius;
+	float farSq = farRadius * farRadius;
+	float thetaSq = FAR_THETA * FAR_THETA;
+	if (nodes_.empty() || DistanceSq(nodes_[0], x, y, z) > farSq)
+		return;
+	unsigned stack[MAX_TREE_STACK];
+	unsigned depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0)
+	{
+		const FlockTreeNode& node = nodes_[stack[--depth]];
+		float distSq = DistanceSq(node, x, y, z);
+		//GatherRuns takes a node that reaches the near sphere and has no children to walk, whole
+		bool isLeaf = !node.numChildren || depth + node.numChildren > MAX_TREE_STACK;
+		if (distSq <= nearSq)
+		{
+			if (isLeaf)
+				continue;
+		}
+		else
+		{
+			//out of reach of the near sphere, so nothing below it was gathered
+			float size = std::max(std::max(node.maxX - node.minX, node.maxY - node.minY), node.maxZ - node.minZ);
+			if (isLeaf || size * size < thetaSq * distSq)
+			{
+				//centre against the range scaled by the count, so the test needs no division
+				float n = (float)node.sum.count;
+				float cx = node.sum.px - x * n;
+				float cy = node.sum.py - y * n;
+				float cz = node.sum.pz - z * n;
+				if (cx * cx + cy * cy + cz * cz < farSq * n * n)
+					AddAggregate(sum, node.sum);
+				continue;
+			}
+		}
+		for (unsigned c = node.numChildren; c-- > 0;)
+		{
+			if (DistanceSq(nodes_[node.firstChild + c], x, y, z) <= farSq)
+				stack[depth++] = node.firstChild + c;
+		}
+	}
+}
+
+//compare flock state indices by one coordinate
+struct AxisLess
+{
+	AxisLess(const std::vector<float>& axis) :
+		axis_(axis)
+	{
+	}
+
+	bool operator()(unsigned a, unsigned b) const { return axis_[a] < axis_[b]; }
+
+	const std::vector<float>& axis_;
+};
+
+FlockKdTree::FlockKdTree(const FlockIndexSettings& settings) :
+	FlockTree(settings)
+{
+}
+
+void FlockKdTree::Build(const FlockState& state)
+{
+	unsigned numBoids = state.Size();
+	nodes_.clear();
+	sortedIndex_.resize(numBoids);
+	for (unsigned i = 0; i < numBoids; i++)
+		sortedIndex_[i] = i;
+	if (numBoids)
+		Split(AddNode(0, numBoids), state);
+	ListLeaves();
+	CopySorted(state);
+	UpdateAggregates();
+}
+
+void FlockKdTree::Split(unsigned node, const FlockState& state)
+{
+	FitBounds(node, state);
+	unsigned begin = nodes_[node].begin;
+	unsigned end = nodes_[node].end;
+	if (end - begin <= leafSize_)
+		return;
+
+	//median along the longest side, nth_element leaves the lower half before it and the upper half after
+	const FlockTreeNode& n = nodes_[node];
+	float sizeX = n.maxX - n.minX;
+	float sizeY = n.maxY - n.minY;
+	float sizeZ = n.maxZ - n.minZ;
+	const std::vector<float>& axis = sizeX >= sizeY && sizeX >= sizeZ ? state.px : (sizeY >= sizeZ ? state.py : state.pz);
+	unsigned middle = begin + (end - begin) / 2;
+	std::nth_element(sortedIndex_.begin() + begin, sortedIndex_.begin() + middle, sortedIndex_.begin() + end,
+		AxisLess(axis));
+
+	//both children are added before either is split, so they sit next to each other
+	unsigned child = AddNode(begin, middle);
+	AddNode(middle, end);
+	nodes_[node].firstChild = child;
+	nodes_[node].numChildren = 2;
+	Split(child, state);
+	Split(child + 1, state);
+}
+
+//spread the low 10 bits of v to every third bit
+static uint32_t SpreadBits(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+FlockOctree::FlockOctree(const FlockIndexSettings& settings) :
+	FlockTree(settings)
+{
+}
+
+void FlockOctree::Build(const FlockState& state)
+{
+	unsigned numBoids = state.Size();
+	nodes_.clear();
+	keys_.resize(numBoids);
+	sortedIndex_.resize(numBoids);
+	if (!numBoids)
+	{
+		CopySorted(state);
+		return;
+	}
+
+	//cube around the whole flock, quantised to MORTON_BITS per axis
+	float minX = state.px[0], minY = state.py[0], minZ = state.pz[0];
+	float maxX = minX, maxY = minY, maxZ = minZ;
+	for (unsigned i = 1; i < numBoids; i++)
+	{
+		minX = std::min(minX, state.px[i]);
+		minY = std::min(minY, state.py[i]);
+		minZ = std::min(minZ, state.pz[i]);
+		maxX = std::max(maxX, state.px[i]);
+		maxY = std::max(maxY, state.py[i]);
+		maxZ = std::max(maxZ, state.pz[i]);
+	}
+	float size = std::max(std::max(maxX - minX, maxY - minY), maxZ - minZ);
+	float scale = size > 0.0f ? ((1 << MORTON_BITS) - 1) / size : 0.0f;
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		uint32_t code = SpreadBits((uint32_t)((state.px[i] - minX) * scale)) |
+			SpreadBits((uint32_t)((state.py[i] - minY) * scale)) << 1 |
+			SpreadBits((uint32_t)((state.pz[i] - minZ) * scale)) << 2;
+		keys_[i] = (uint64_t)code << 32 | i;
+	}
+	std::sort(keys_.begin(), keys_.end());
+	for (unsigned slot = 0; slot < numBoids; slot++)
+		sortedIndex_[slot] = (unsigned)keys_[slot];
+
+	Subdivide(AddNode(0, numBoids), 0, state);
+	ListLeaves();
+	CopySorted(state);
+	UpdateAggregates();
+}
+
+void FlockOctree::Subdivide(unsigned node, unsigned level, const FlockState& state)
+{
+	unsigned begin = nodes_[node].begin;
+	unsigned end = nodes_[node].end;
+	//boids closer than the last level share a leaf, however many there are
+	if (end - begin <= leafSize_ || level == MORTON_BITS)
+	{
+		FitBounds(node, state);
+		return;
+	}
+
+	//the codes of the node share their bits above this level, so its octants follow each other in the sorted keys
+	unsigned shift = 32 + 3 * (MORTON_BITS - 1 - level);
+	unsigned firstChild = (unsigned)nodes_.size();
+	for (unsigned slot = begin; slot < end;)
+	{
+		uint64_t octant = keys_[slot] >> shift & 7;
+		unsigned octantEnd = slot + 1;
+		while (octantEnd < end && (keys_[octantEnd] >> shift & 7) == octant)
+			octantEnd++;
+		AddNode(slot, octantEnd);
+		slot = octantEnd;
+	}
+	unsigned numChildren = (unsigned)nodes_.size() - firstChild;
+	nodes_[node].firstChild = firstChild;
+	nodes_[node].numChildren = numChildren;
+
+	for (unsigned c = 0; c < numChildren; c++)
+	{
+		Subdivide(firstChild + c, level + 1, state);
+		//bounds of a node are its children's together, nodes_ may have moved so it is looked up every time
+		const FlockTreeNode& child = nodes_[firstChild + c];
+		FlockTreeNode& n = nodes_[node];
+		n.minX = std::min(n.minX, child.minX);
+		n.minY = std::min(n.minY, child.minY);
+		n.minZ = std::min(n.minZ, child.minZ);
+		n.maxX = std::max(n.maxX, child.maxX);
+		n.maxY = std::max(n.maxY, child.maxY);
+		n.maxZ = std::max(n.maxZ, child.maxZ);
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "FlockIndex.h"
+
+#include <cstdint>
+
+/// Node of a flock tree. Its boids are the sorted slots [begin, end), and its bounds are fitted to them.
+struct FlockTreeNode
+{
+	float minX, minY, minZ;
+	float maxX, maxY, maxZ;
+	unsigned begin;
+	unsigned end;
+	/// Children are stored back to back from firstChild, at most eight, a leaf has none.
+	unsigned firstChild;
+	unsigned numChildren;
+	/// Count, position sum and velocity sum of its boids.
+	FlockAggregate sum;
+};
+
+/// Tree over the sorted slots, every node a contiguous block of them. The query walks the nodes whose bounds reach
+/// the sphere and appends the slots of the leaves it gets to, so dense schools are cut down to leaves of a few boids
+/// instead of whole cells. Needs no extents, the root is fitted to the flock.
+class FlockTree : public FlockIndex
+{
+public:
+	/// Construct with the leaf size of the settings.
+	explicit FlockTree(const FlockIndexSettings& settings);
+
+	/// Append the slots of every leaf whose bounds reach the sphere, joined where leaves are next to each other. With
+	/// maxSlots the walk takes the nearest child first and stops once the leaves hold that many boids.
+	virtual void GatherRuns(float x, float y, float z, float radius, unsigned maxSlots, std::vector<FlockRun>& runs) const;
+	/// Test only the leaves of the candidates. Node bounds hold their children's, so a leaf GatherRuns reaches is one
+	/// whose own bounds reach the sphere, and candidates in slot order give the leaves in its order.
+	virtual void FilterRuns(float x, float y, float z, float radius, const std::vector<FlockRun>& candidates,
+		std::vector<FlockRun>& runs) const;
+	virtual bool FiltersRuns() const { return true; }
+	/// Barnes-Hut walk of the nodes out of reach of the near sphere: a node small for its distance, or a leaf, is
+	/// taken whole, a larger one is opened. Leaves GatherRuns takes are skipped.
+	virtual void SumFar(float x, float y, float z, float nearRadius, float farRadius, FlockAggregate& sum) const;
+
+	/// Nodes, the root first.
+	std::vector<FlockTreeNode> nodes_;
+
+protected:
+	/// Add a node over slots [begin, end) with no children and return its index.
+	unsigned AddNode(unsigned begin, unsigned end);
+	/// Fit the bounds of a node to the boids of its slots.
+	void FitBounds(unsigned node, const FlockState& state);
+	/// Sum the aggregate of every node. Children always come after their parent.
+	virtual void UpdateAggregates();
+	/// List the leaves in slot order, after a build.
+	void ListLeaves();
+
+	/// Most boids a leaf holds.
+	unsigned leafSize_;
+	/// Leaf nodes in slot order.
+	std::vector<unsigned> leaves_;
+};
+
+/// k-d tree split at the median along the longest side of each node. Every split halves the boids, so leaves hold
+/// the same number of boids however tightly the school is packed.
+class FlockKdTree : public FlockTree
+{
+public:
+	/// Construct with the leaf size of the settings.
+	explicit FlockKdTree(const FlockIndexSettings& settings);
+
+	/// Rebuild from the flock state: recursive median splits of the slot order, then copy the state into it.
+	virtual void Build(const FlockState& state);
+	virtual FlockIndexType GetType() const { return FLOCK_INDEX_KDTREE; }
+
+private:
+	/// Fit a node and split it in two until it is small enough to be a leaf.
+	void Split(unsigned node, const FlockState& state);
+};
+
+/// Octree over the Morton order of the boids in a cube fitted to the flock. Sorting by Morton code puts every
+/// octant of every level in a contiguous block of slots, so the tree is built by cutting the sorted order, with no
+/// pointers per boid. Node bounds are fitted to the boids they hold rather than to their octant, so like a loose
+/// octree they overlap where boids straddle an octant boundary and stay tight around a small school.
+class FlockOctree : public FlockTree
+{
+public:
+	/// Construct with the leaf size of the settings.
+	explicit FlockOctree(const FlockIndexSettings& settings);
+
+	/// Rebuild from the flock state: Morton sort, copy the state into that order, cut into octants.
+	virtual void Build(const FlockState& state);
+	virtual FlockIndexType GetType() const { return FLOCK_INDEX_OCTREE; }
+
+private:
+	/// Cut a node into its non-empty octants at a level until it is small enough to be a leaf.
+	void Subdivide(unsigned node, unsigned level, const FlockState& state);
+
+	/// Morton code in the high half and flock state index in the low half of each boid, sorted.
+	std::vector<uint64_t> keys_;
+};
@@ -0,0 +1,28 @@
+#include "FlockVerlet.h"
+
+FlockVerletLists::FlockVerletLists() :
+	skin_(0.0f),
+	generation_(0)
+{
+}
+
+void FlockVerletLists::Invalidate(unsigned numBoids)
+{
+	//lists start at generation 0, so the first build is generation 1
+	generation_++;
+	lists_.resize(numBoids);
+}
+
+const FlockVerletList& FlockVerletLists::GetList(const FlockIndex& index, unsigned boid, float x, float y, float z,
+	float radius)
+{
+	FlockVerletList& list = lists_[boid];
+	if (list.generation != generation_)
+	{
+		//clear keeps the capacity, after the first few builds no list allocates
+		list.runs.clear();
+		index.GatherRuns(x, y, z, radius + skin_, 0, list.runs);
+		list.generation = generation_;
+	}
+	return list;
+}
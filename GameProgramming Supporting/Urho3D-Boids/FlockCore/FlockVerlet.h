@@ -0,0 +1,43 @@
+#pragma once
+
+#include "FlockIndex.h"
+
+/// Cached neighbourhood of one boid: the runs around where it was when they were gathered.
+struct FlockVerletList
+{
+	FlockVerletList() :
+		generation(0)
+	{
+	}
+
+	std::vector<FlockRun> runs;
+	/// Build the runs were gathered on, stale when it is not the current one.
+	unsigned generation;
+};
+
+/// Verlet neighbour lists: the runs of every boid gathered at the search radius plus a skin, then reused over the
+/// following steps while the index is only refreshed. The cells and node bounds stay as they were built, and queries
+/// on the refreshed index are widened by its drift. While the drift stays under GetRebuildDrift(), every run such a
+/// query returns is in the list and FlockIndex::FilterRuns picks them out. The caller builds the index again once the
+/// drift passes it, and every list is gathered again on first use after that.
+class FlockVerletLists
+{
+public:
+	FlockVerletLists();
+
+	/// Set the skin, 0 gathers every list every step.
+	void SetSkin(float skin) { skin_ = std::max(skin, 0.0f); }
+	float GetSkin() const { return skin_; }
+	/// Return the index drift past which the lists no longer hold every neighbour.
+	float GetRebuildDrift() const { return 0.5f * skin_; }
+	/// Mark every list stale, after each build of the index, and size them for the flock.
+	void Invalidate(unsigned numBoids);
+	/// Return the list of a boid, gathered around a position first when it is stale. Every boid has its own list, so
+	/// different boids can be served on any thread.
+	const FlockVerletList& GetList(const FlockIndex& index, unsigned boid, float x, float y, float z, float radius);
+
+private:
+	float skin_;
+	unsigned generation_;
+	std::vector<FlockVerletList> lists_;
+};
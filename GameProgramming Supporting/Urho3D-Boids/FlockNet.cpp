@@ -0,0 +1,425 @@
+#include "FlockNet.h"
+#include "Boids.h"
+
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+//positions are sent as a fraction of the quantisation box in 16 bits per axis
+static unsigned short Quantise(float value, float min, float max)
+{
+	float t = Clamp((value - min) / (max - min), 0.0f, 1.0f);
+	return (unsigned short)(t * 65535.0f + 0.5f);
+}
+
+static float Dequantise(unsigned short value, float min, float max)
+{
+	return min + (max - min) * (value / 65535.0f);
+}
+
+//heading as yaw around Y in 256 steps and pitch from -90 to 90 degrees in 255 steps
+static void PackHeading(float vx, float vy, float vz, unsigned char& yaw, unsigned char& pitch)
+{
+	float y = Atan2(vx, vz);
+	float p = Atan2(vy, sqrtf(vx * vx + vz * vz));
+	yaw = (unsigned char)((int)floorf((y + 180.0f) * (256.0f / 360.0f) + 0.5f) & 0xff);
+	pitch = (unsigned char)((p + 90.0f) * (255.0f / 180.0f) + 0.5f);
+}
+
+static Vector3 UnpackHeading(unsigned char yaw, unsigned char pitch)
+{
+	float y = yaw * (360.0f / 256.0f) - 180.0f;
+	float p = pitch * (180.0f / 255.0f) - 90.0f;
+	float c = Cos(p);
+	return Vector3(c * Sin(y), Sin(p), c * Cos(y));
+}
+
+//signed deltas folded onto unsigned so small steps either way fit in one or two VLE bytes
+static unsigned ZigZag(int value)
+{
+	return (unsigned)((value << 1) ^ (value >> 31));
+}
+
+static int UnZigZag(unsigned value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+//wire format of one boid: VLE id, then a byte that is 0 for a full sample or the number of messages back
+//to the baseline the delta refers to
+static void WriteFull(VectorBuffer& message, const FlockSample& sample)
+{
+	message.WriteUByte(0);
+	message.WriteUShort(sample.x_);
+	message.WriteUShort(sample.y_);
+	message.WriteUShort(sample.z_);
+	message.WriteUByte(sample.yaw_);
+	message.WriteUByte(sample.pitch_);
+}
+
+static void WriteDelta(VectorBuffer& message, unsigned char offset, const FlockSample& sample, const FlockSample& base)
+{
+	message.WriteUByte(offset);
+	message.WriteVLE(ZigZag((int)sample.x_ - (int)base.x_));
+	message.WriteVLE(ZigZag((int)sample.y_ - (int)base.y_));
+	message.WriteVLE(ZigZag((int)sample.z_ - (int)base.z_));
+	//headings wrap, so the byte difference modulo 256 is exact
+	message.WriteUByte((unsigned char)(sample.yaw_ - base.yaw_));
+	message.WriteUByte((unsigned char)(sample.pitch_ - base.pitch_));
+}
+
+FlockSnapshotWriter::FlockSnapshotWriter() :
+	viewDistance_(M_INFINITY),
+	frame_(0),
+	bytesSent_(0)
+{
+}
+
+void FlockSnapshotWriter::Prepare(const BoidSet& boids, const BoundingBox& bounds)
+{
+	const FlockState& state = boids.state;
+	const Vector3& min = bounds.min_;
+	const Vector3& max = bounds.max_;
+	bounds_ = bounds;
+	frame_++;
+	bytesSent_ = 0;
+
+	ids_.Clear();
+	samples_.Clear();
+	positions_.Clear();
+	for (unsigned i = 0; i < state.Size(); i++)
+	{
+		//a fish that got out of the tank still flocks and can be eaten, it is drawn on the edge of the box
+		FlockSample sample;
+		sample.x_ = Quantise(state.px[i], min.x_, max.x_);
+		sample.y_ = Quantise(state.py[i], min.y_, max.y_);
+		sample.z_ = Quantise(state.pz[i], min.z_, max.z_);
+		PackHeading(state.vx[i], state.vy[i], state.vz[i], sample.yaw_, sample.pitch_);
+		ids_.Push(boids.boidList[i].id);
+		samples_.Push(sample);
+		positions_.Push(Vector3(state.px[i], state.py[i], state.pz[i]));
+	}
+}
+
+void FlockSnapshotWriter::Send(Connection* connection)
+{
+	ClientStream& client = clients_[connection];
+	if (client.sent_.Empty())
+		client.sent_.Resize(FLOCK_SENT_RECORDS);
+
+	//full rate in the nearest third of the view distance, then every 2nd and every 4th frame, nothing past it
+	const Vector3& eye = connection->GetPosition();
+	float nearSq = viewDistance_ * viewDistance_ / 9.0f;
+	float midSq = nearSq * 4.0f;
+	float farSq = viewDistance_ * viewDistance_;
+
+	SentRecord* record = nullptr;
+	for (unsigned i = 0; i < ids_.Size(); i++)
+	{
+		float distSq = (positions_[i] - eye).LengthSquared();
+		if (distSq > farSq)
+			continue;
+		unsigned interval = distSq < nearSq ? 1 : (distSq < midSq ? 2 : 4);
+		unsigned id = ids_[i];
+		//offset by id so the slower bands are spread over frames instead of all landing on the same one
+		if ((frame_ + id) % interval)
+			continue;
+
+		if (!record)
+			BeginMessage(client, message_, record);
+
+		HashMap<unsigned, BoidStream>::Iterator it = client.boids_.Find(id);
+		if (it == client.boids_.End())
+		{
+			BoidStream stream;
+			stream.numSent_ = 0;
+			stream.ackedSequence_ = 0;
+			stream.hasAcked_ = false;
+			it = client.boids_.Insert(MakePair(id, stream));
+		}
+		BoidStream& boid = it->second_;
+		const FlockSample& sample = samples_[i];
+
+		//delta only against an acknowledged update that is still one of the last FLOCK_HISTORY sends,
+		//the client keeps the newest FLOCK_HISTORY it received so it is sure to still have it
+		const FlockSample* base = nullptr;
+		unsigned short offset = client.sequence_ - boid.ackedSequence_;
+		if (boid.hasAcked_ && offset > 0 && offset <= 255)
+		{
+			for (unsigned h = 0; h < Min(boid.numSent_, FLOCK_HISTORY); h++)
+			{
+				if (boid.sequence_[h] == boid.ackedSequence_)
+				{
+					base = &boid.sample_[h];
+					break;
+				}
+			}
+		}
+
+		message_.WriteVLE(id);
+		if (base)
+			WriteDelta(message_, (unsigned char)offset, sample, *base);
+		else
+			WriteFull(message_, sample);
+
+		unsigned slot = boid.numSent_ % FLOCK_HISTORY;
+		boid.sequence_[slot] = client.sequence_;
+		boid.sample_[slot] = sample;
+		boid.numSent_++;
+		record->ids_.Push(id);
+
+		if (message_.GetSize() >= FLOCK_MESSAGE_BUDGET)
+		{
+			connection->SendMessage(MSG_FLOCKSNAPSHOT, false, false, message_);
+			bytesSent_ += message_.GetSize();
+			record = nullptr;
+		}
+	}
+	if (record)
+	{
+		connection->SendMessage(MSG_FLOCKSNAPSHOT, false, false, message_);
+		bytesSent_ += message_.GetSize();
+	}
+}
+
+void FlockSnapshotWriter::BeginMessage(ClientStream& client, VectorBuffer& message, SentRecord*& record)
+{
+	client.sequence_++;
+	record = &client.sent_[client.sequence_ % FLOCK_SENT_RECORDS];
+	record->sequence_ = client.sequence_;
+	record->acked_ = false;
+	record->ids_.Clear();
+
+	message.Clear();
+	message.WriteUShort(client.sequence_);
+	message.WriteVector3(bounds_.min_);
+	message.WriteVector3(bounds_.max_);
+}
+
+void FlockSnapshotWriter::Acknowledge(Connection* connection, MemoryBuffer& message)
+{
+	HashMap<Connection*, ClientStream>::Iterator it = clients_.Find(connection);
+	if (it == clients_.End() || it->second_.sent_.Empty())
+		return;
+	unsigned short newest = message.ReadUShort();
+	unsigned bits = message.ReadUInt();
+	AcknowledgeMessage(it->second_, newest);
+	for (unsigned b = 0; b < 32; b++)
+	{
+		if (bits & (1u << b))
+			AcknowledgeMessage(it->second_, (unsigned short)(newest - 1 - b));
+	}
+}
+
+void FlockSnapshotWriter::AcknowledgeMessage(ClientStream& client, unsigned short sequence)
+{
+	SentRecord& record = client.sent_[sequence % FLOCK_SENT_RECORDS];
+	//already handled, or so old its record has been reused
+	if (record.acked_ || record.sequence_ != sequence)
+		return;
+	record.acked_ = true;
+	for (unsigned j = 0; j < record.ids_.Size(); j++)
+	{
+		HashMap<unsigned, BoidStream>::Iterator it = client.boids_.Find(record.ids_[j]);
+		if (it == client.boids_.End())
+			continue;
+		BoidStream& boid = it->second_;
+		if (!boid.hasAcked_ || (short)(sequence - boid.ackedSequence_) > 0)
+		{
+			boid.ackedSequence_ = sequence;
+			boid.hasAcked_ = true;
+		}
+	}
+}
+
+void FlockSnapshotWriter::RemoveConnection(Connection* connection)
+{
+	clients_.Erase(connection);
+}
+
+FlockReplica::FlockReplica() :
+	pRes_(nullptr),
+	pScene_(nullptr),
+	delay_(DEFAULT_INTERPOLATION_DELAY),
+	ackSequence_(0),
+	ackBits_(0),
+	hasAck_(false)
+{
+}
+
+void FlockReplica::Initialise(ResourceCache* pRes, Scene* pScene)
+{
+	pRes_ = pRes;
+	pScene_ = pScene;
+	replicas_.Clear();
+	hasAck_ = false;
+}
+
+void FlockReplica::Read(MemoryBuffer& message, float time)
+{
+	if (!pScene_)
+		return;
+	unsigned short sequence = message.ReadUShort();
+	Vector3 min = message.ReadVector3();
+	Vector3 max = message.ReadVector3();
+
+	//remember the message for the next acknowledgement
+	if (!hasAck_)
+	{
+		ackSequence_ = sequence;
+		ackBits_ = 0;
+		hasAck_ = true;
+	}
+	else
+	{
+		short ahead = (short)(sequence - ackSequence_);
+		if (ahead > 0)
+		{
+			ackBits_ = ahead < 32 ? (ackBits_ << ahead) | (1u << (ahead - 1)) : (ahead == 32 ? 1u << 31 : 0);
+			ackSequence_ = sequence;
+		}
+		else if (ahead < 0 && ahead >= -32)
+			ackBits_ |= 1u << (-ahead - 1);
+	}
+
+	while (!message.IsEof())
+	{
+		unsigned id = message.ReadVLE();
+		unsigned char offset = message.ReadUByte();
+		FlockSample sample;
+		int dx = 0, dy = 0, dz = 0;
+		if (offset == 0)
+		{
+			sample.x_ = message.ReadUShort();
+			sample.y_ = message.ReadUShort();
+			sample.z_ = message.ReadUShort();
+			sample.yaw_ = message.ReadUByte();
+			sample.pitch_ = message.ReadUByte();
+		}
+		else
+		{
+			dx = UnZigZag(message.ReadVLE());
+			dy = UnZigZag(message.ReadVLE());
+			dz = UnZigZag(message.ReadVLE());
+			sample.yaw_ = message.ReadUByte();
+			sample.pitch_ = message.ReadUByte();
+		}
+
+		HashMap<unsigned, Replica>::Iterator it = replicas_.Find(id);
+		if (it == replicas_.End())
+		{
+			//a delta for a boid never seen can not be decoded, the server sends it whole again once that baseline leaves its history
+			if (offset != 0)
+				continue;
+			Replica replica;
+			replica.node_ = CreateNode();
+			replica.lastSeen_ = time;
+			replica.sequence_ = sequence - 1;
+			replica.numHistory_ = 0;
+			it = replicas_.Insert(MakePair(id, replica));
+		}
+		Replica& replica = it->second_;
+
+		if (offset != 0)
+		{
+			unsigned short baseSequence = sequence - offset;
+			unsigned h = 0;
+			while (h < replica.numHistory_ && replica.historySequence_[h] != baseSequence)
+				h++;
+			if (h == replica.numHistory_)
+				continue;
+			const FlockSample& base = replica.history_[h];
+			sample.x_ = (unsigned short)(base.x_ + dx);
+			sample.y_ = (unsigned short)(base.y_ + dy);
+			sample.z_ = (unsigned short)(base.z_ + dz);
+			sample.yaw_ = (unsigned char)(base.yaw_ + sample.yaw_);
+			sample.pitch_ = (unsigned char)(base.pitch_ + sample.pitch_);
+		}
+
+		//keep the newest FLOCK_HISTORY samples, late arrivals included, as they may become a baseline
+		unsigned slot = replica.numHistory_;
+		if (slot == FLOCK_HISTORY)
+		{
+			slot = 0;
+			for (unsigned h = 1; h < FLOCK_HISTORY; h++)
+			{
+				if ((short)(replica.historySequence_[h] - replica.historySequence_[slot]) < 0)
+					slot = h;
+			}
+			if ((short)(sequence - replica.historySequence_[slot]) < 0)
+				slot = FLOCK_HISTORY;
+		}
+		else
+			replica.numHistory_++;
+		if (slot < FLOCK_HISTORY)
+		{
+			replica.historySequence_[slot] = sequence;
+			replica.history_[slot] = sample;
+		}
+
+		//unreliable messages may arrive out of order, never step a boid back to an older snapshot
+		if ((short)(sequence - replica.sequence_) <= 0)
+			continue;
+		replica.sequence_ = sequence;
+		//back from being hidden, do not glide in from where it was last seen
+		if (time - replica.lastSeen_ > FLOCK_REPLICA_TIMEOUT)
+			replica.buffer_.Clear();
+		replica.lastSeen_ = time;
+
+		Vector3 position(Dequantise(sample.x_, min.x_, max.x_), Dequantise(sample.y_, min.y_, max.y_),
+			Dequantise(sample.z_, min.z_, max.z_));
+		replica.buffer_.Add(time, position, Boids::HeadingRotation(UnpackHeading(sample.yaw_, sample.pitch_)));
+		replica.node_->SetEnabled(true);
+	}
+}
+
+void FlockReplica::Update(float time)
+{
+	for (HashMap<unsigned, Replica>::Iterator it = replicas_.Begin(); it != replicas_.End(); ++it)
+	{
+		Replica& replica = it->second_;
+		if (!replica.node_->IsEnabled())
+			continue;
+		if (time - replica.lastSeen_ > FLOCK_REPLICA_TIMEOUT)
+		{
+			replica.node_->SetEnabled(false);
+			continue;
+		}
+		//boids in the slower rate bands are drawn further back, so there is still a newer state to move towards
+		Vector3 position;
+		Quaternion rotation;
+		if (replica.buffer_.Sample(time - Max(delay_, 1.5f * replica.buffer_.GetInterval()), position, rotation))
+			replica.node_->SetTransform(position, rotation);
+	}
+}
+
+bool FlockReplica::WriteAck(VectorBuffer& message) const
+{
+	if (!hasAck_)
+		return false;
+	message.WriteUShort(ackSequence_);
+	message.WriteUInt(ackBits_);
+	return true;
+}
+
+void FlockReplica::Clear()
+{
+	for (HashMap<unsigned, Replica>::Iterator it = replicas_.Begin(); it != replicas_.End(); ++it)
+		it->second_.node_->Remove();
+	replicas_.Clear();
+	hasAck_ = false;
+}
+
+Node* FlockReplica::CreateNode()
+{
+	Node* node = pScene_->CreateChild("Cone", LOCAL);
+	StaticModel* object = node->CreateComponent<StaticModel>(LOCAL);
+	object->SetModel(pRes_->GetResource<Model>("Models/Cone.mdl"));
+	object->SetMaterial(pRes_->GetResource<Material>("Materials/Mushroom.xml"));
+	object->SetCastShadows(false);
+	return node;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include "SnapshotBuffer.h"
+
+namespace Urho3D
+{
+	class Connection;
+	class MemoryBuffer;
+	class Node;
+	class ResourceCache;
+	class Scene;
+}
+
+using namespace Urho3D;
+
+class BoidSet;
+
+/// Custom network message carrying a slice of the flock, well clear of the engine's own message ids.
+static const int MSG_FLOCKSNAPSHOT = 0x80;
+/// Client to server acknowledgement of the snapshot messages received.
+static const int MSG_FLOCKACK = 0x81;
+/// Payload bytes after which a snapshot message is closed, keeps every message inside a single UDP datagram.
+static const unsigned FLOCK_MESSAGE_BUDGET = 1100;
+/// Seconds without an update before a client hides a boid. Covers despawned, eaten and culled boids as well as
+/// lost packets, and must be longer than the update interval of the farthest rate band.
+static const float FLOCK_REPLICA_TIMEOUT = 1.0f;
+/// Updates of one boid both ends remember. A delta may only refer to one of the last FLOCK_HISTORY sends.
+static const unsigned FLOCK_HISTORY = 8;
+/// Sent messages the server remembers for matching acknowledgements, covers the 32 bit ack mask.
+static const unsigned FLOCK_SENT_RECORDS = 64;
+
+/// One boid as it goes over the wire: a 16 bit position per axis inside the quantisation box and a byte each
+/// for heading yaw and pitch.
+struct FlockSample
+{
+	unsigned short x_, y_, z_;
+	unsigned char yaw_, pitch_;
+};
+
+/// Server side of the flock channel. The flock is quantised once per network frame, then every client gets
+/// its own stream: boids are sent at a rate that falls with distance from the client's camera, culled past
+/// the fog, and delta encoded against the last update of that boid the client has acknowledged.
+class FlockSnapshotWriter
+{
+public:
+	/// Construct.
+	FlockSnapshotWriter();
+
+	/// Set the view distance, boids farther than this from a client's camera are not sent to it.
+	void SetViewDistance(float distance) { viewDistance_ = distance; }
+	/// Quantise the active boids for this network frame. Boids outside the bounds are clamped onto them, the box
+	/// stays the same every frame so deltas against earlier samples hold.
+	void Prepare(const BoidSet& boids, const BoundingBox& bounds);
+	/// Write and send this frame's stream for one client. Unreliable, lost updates are covered by the next.
+	void Send(Connection* connection);
+	/// Apply a MSG_FLOCKACK from a client.
+	void Acknowledge(Connection* connection, MemoryBuffer& message);
+	/// Forget a disconnected client.
+	void RemoveConnection(Connection* connection);
+	/// Return the bytes sent to all clients in the current network frame.
+	unsigned GetSize() const { return bytesSent_; }
+
+private:
+	/// What one client has been sent of one boid.
+	struct BoidStream
+	{
+		/// Last FLOCK_HISTORY sends, slot = send count % FLOCK_HISTORY.
+		unsigned short sequence_[FLOCK_HISTORY];
+		FlockSample sample_[FLOCK_HISTORY];
+		unsigned numSent_;
+		/// Newest acknowledged message that carried this boid, valid once hasAcked_.
+		unsigned short ackedSequence_;
+		bool hasAcked_;
+	};
+	/// Boid ids carried by one sent message, to resolve acknowledgements.
+	struct SentRecord
+	{
+		SentRecord() : sequence_(0), acked_(true) {}
+
+		unsigned short sequence_;
+		bool acked_;
+		PODVector<unsigned> ids_;
+	};
+	/// Per client stream state.
+	struct ClientStream
+	{
+		ClientStream() : sequence_(0) {}
+
+		unsigned short sequence_;
+		HashMap<unsigned, BoidStream> boids_;
+		Vector<SentRecord> sent_;
+	};
+
+	/// Start a new message of a client stream and its sent record.
+	void BeginMessage(ClientStream& client, VectorBuffer& message, SentRecord*& record);
+	/// Mark every boid of a sent message as acknowledged at its sequence.
+	void AcknowledgeMessage(ClientStream& client, unsigned short sequence);
+
+	/// This frame's boids.
+	PODVector<unsigned> ids_;
+	PODVector<FlockSample> samples_;
+	PODVector<Vector3> positions_;
+	BoundingBox bounds_;
+	float viewDistance_;
+	unsigned frame_;
+	unsigned bytesSent_;
+	HashMap<Connection*, ClientStream> clients_;
+	VectorBuffer message_;
+};
+
+/// Client side of the flock channel. Boids exist only as LOCAL nodes keyed by the server's boid id. Updates
+/// go into a SnapshotBuffer per boid and the nodes are placed from those at a delay every frame.
+class FlockReplica
+{
+public:
+	/// Construct.
+	FlockReplica();
+
+	/// Start over in a new scene. Nodes of the previous scene are not touched, they went with it.
+	void Initialise(ResourceCache* pRes, Scene* pScene);
+	/// Set how many seconds behind the newest update boids are rendered.
+	void SetDelay(float delay) { delay_ = delay; }
+	/// Apply one snapshot message received at time.
+	void Read(MemoryBuffer& message, float time);
+	/// Place the boid nodes for time and hide boids that have not been in a snapshot for FLOCK_REPLICA_TIMEOUT seconds.
+	void Update(float time);
+	/// Write the MSG_FLOCKACK for the messages received so far. Returns false when there is nothing to acknowledge.
+	bool WriteAck(VectorBuffer& message) const;
+	/// Remove every replica node from the scene.
+	void Clear();
+
+private:
+	struct Replica
+	{
+		Node* node_;
+		/// Time of the last applied update.
+		float lastSeen_;
+		/// Applied updates to render from.
+		SnapshotBuffer buffer_;
+		/// Sequence of the newest applied update.
+		unsigned short sequence_;
+		/// Newest FLOCK_HISTORY updates received, the baselines deltas refer to.
+		unsigned short historySequence_[FLOCK_HISTORY];
+		FlockSample history_[FLOCK_HISTORY];
+		unsigned numHistory_;
+	};
+
+	/// Create the cone node of a newly seen boid.
+	Node* CreateNode();
+
+	ResourceCache* pRes_;
+	Scene* pScene_;
+	HashMap<unsigned, Replica> replicas_;
+	float delay_;
+	/// Newest message sequence received and a bit for each of the 32 before it.
+	unsigned short ackSequence_;
+	unsigned ackBits_;
+	bool hasAck_;
+};
@@ -0,0 +1,264 @@
+#include "FlockSync.h"
+
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Network/Network.h>
+
+FlockSyncServer::FlockSyncServer() :
+	nextSlice_(0)
+{
+}
+
+void FlockSyncServer::Send(BoidSet& boids, float timeStep, Network* network)
+{
+	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+	bool written = false;
+	for (unsigned i = 0; i < connections.Size(); i++)
+	{
+		Connection* connection = connections[i];
+		if (!connection->IsSceneLoaded())
+			continue;
+		if (!synced_.Contains(connection))
+		{
+			//the keyframe already holds this frame's events, the client gets events from the next frame on
+			VectorBuffer keyframe;
+			WriteKeyframe(boids, timeStep, keyframe);
+			connection->SendMessage(MSG_FLOCKKEYFRAME, true, true, keyframe);
+			synced_.Push(connection);
+			continue;
+		}
+
+		if (!written)
+		{
+			const FlockState& state = boids.state;
+			message_.Clear();
+			message_.WriteUInt(boids.GetTick());
+			message_.WriteVLE(boids.events.Size());
+			for (unsigned j = 0; j < boids.events.Size(); j++)
+			{
+				const FlockEvent& event = boids.events[j];
+				message_.WriteUByte((unsigned char)event.type);
+				message_.WriteVLE(event.tick);
+				message_.WriteVLE(event.id);
+				if (event.type == FLOCK_EVENT_SPAWN)
+				{
+					message_.WriteVLE(event.school);
+					message_.WriteVector3(event.centre);
+					message_.WriteFloat(event.spread);
+				}
+			}
+
+			unsigned numBoids = boids.GetNumBoids();
+			unsigned sliceSize = Min(FLOCK_KEYFRAME_SLICE, numBoids);
+			message_.WriteVLE(sliceSize);
+			for (unsigned j = 0; j < sliceSize; j++)
+			{
+				unsigned index = (nextSlice_ + j) % numBoids;
+				message_.WriteVLE(boids.boidList[index].id);
+				message_.WriteVector3(Vector3(state.px[index], state.py[index], state.pz[index]));
+				message_.WriteVector3(Vector3(state.vx[index], state.vy[index], state.vz[index]));
+			}
+			nextSlice_ = numBoids > 0 ? (nextSlice_ + sliceSize) % numBoids : 0;
+			written = true;
+		}
+		connection->SendMessage(MSG_FLOCKEVENTS, true, true, message_);
+	}
+	boids.events.Clear();
+}
+
+void FlockSyncServer::RemoveConnection(Connection* connection)
+{
+	synced_.Remove(connection);
+}
+
+void FlockSyncServer::WriteKeyframe(const BoidSet& boids, float timeStep, VectorBuffer& message) const
+{
+	//everything the step depends on, so the client runs exactly the server's flock
+	const FlockSettings& settings = boids.GetSettings();
+	const FlockState& state = boids.state;
+	message.WriteUInt(settings.seed);
+	message.WriteUInt(boids.GetTick());
+	message.WriteFloat(timeStep);
+	message.WriteFloat(settings.cellSize);
+	//the neighbours a boid sees depend on the backend, auto mode switches on the same steps from here on
+	message.WriteUByte((unsigned char)settings.indexType);
+	message.WriteUByte((unsigned char)boids.GetIndexType());
+	message.WriteFloat(settings.minX);
+	message.WriteFloat(settings.minZ);
+	message.WriteFloat(settings.maxX);
+	message.WriteFloat(settings.maxZ);
+	message.WriteVLE(settings.maxNeighbours);
+	message.WriteBool(settings.incrementalGrid);
+	message.WriteBool(settings.useSimd);
+	message.WriteBool(settings.farField);
+
+	//in boidList order, the force sums depend on it
+	message.WriteVLE(boids.GetNumBoids());
+	for (unsigned i = 0; i < boids.GetNumBoids(); i++)
+	{
+		message.WriteVLE(boids.boidList[i].id);
+		message.WriteVLE(boids.boidList[i].school);
+		message.WriteVector3(Vector3(state.px[i], state.py[i], state.pz[i]));
+		message.WriteVector3(Vector3(state.vx[i], state.vy[i], state.vz[i]));
+	}
+}
+
+FlockSyncClient::FlockSyncClient() :
+	pRes_(nullptr),
+	pScene_(nullptr),
+	latestTick_(0),
+	clock_(0.0f),
+	timeStep_(0.0f),
+	delay_(0.1f),
+	active_(false)
+{
+}
+
+void FlockSyncClient::Initialise(ResourceCache* pRes, Scene* pScene)
+{
+	pRes_ = pRes;
+	pScene_ = pScene;
+	flock_ = BoidSet();
+	pending_.Clear();
+	active_ = false;
+}
+
+void FlockSyncClient::Read(int messageID, MemoryBuffer& message)
+{
+	if (!pScene_)
+		return;
+
+	if (messageID == MSG_FLOCKKEYFRAME)
+	{
+		FlockSettings settings;
+		settings.numBoids = 0;
+		settings.kinematic = true;
+		settings.seed = message.ReadUInt();
+		unsigned tick = message.ReadUInt();
+		timeStep_ = message.ReadFloat();
+		settings.cellSize = message.ReadFloat();
+		settings.indexType = (FlockIndexType)message.ReadUByte();
+		FlockIndexType indexType = (FlockIndexType)message.ReadUByte();
+		settings.minX = message.ReadFloat();
+		settings.minZ = message.ReadFloat();
+		settings.maxX = message.ReadFloat();
+		settings.maxZ = message.ReadFloat();
+		settings.maxNeighbours = message.ReadVLE();
+		settings.incrementalGrid = message.ReadBool();
+		settings.useSimd = message.ReadBool();
+		settings.farField = message.ReadBool();
+
+		flock_.Clear();
+		flock_.Initialise(pRes_, pScene_, settings);
+		flock_.SetIndexType(indexType);
+		flock_.SetTick(tick);
+		unsigned count = message.ReadVLE();
+		for (unsigned i = 0; i < count && !message.IsEof(); i++)
+		{
+			unsigned id = message.ReadVLE();
+			unsigned school = message.ReadVLE();
+			Vector3 position = message.ReadVector3();
+			Vector3 velocity = message.ReadVector3();
+			flock_.AddBoid(id, school, position, velocity);
+		}
+		pending_.Clear();
+		latestTick_ = tick;
+		clock_ = tick - delay_ / timeStep_;
+		active_ = true;
+	}
+	else if (messageID == MSG_FLOCKEVENTS && active_)
+	{
+		unsigned tick = message.ReadUInt();
+		unsigned numEvents = message.ReadVLE();
+		for (unsigned i = 0; i < numEvents && !message.IsEof(); i++)
+		{
+			Pending item;
+			item.correction_ = false;
+			item.event_.type = (FlockEventType)message.ReadUByte();
+			item.event_.tick = message.ReadVLE();
+			item.event_.id = message.ReadVLE();
+			if (item.event_.type == FLOCK_EVENT_SPAWN)
+			{
+				item.event_.school = message.ReadVLE();
+				item.event_.centre = message.ReadVector3();
+				item.event_.spread = message.ReadFloat();
+			}
+			pending_.Push(item);
+		}
+
+		//the corrections are the state at tick, after that tick's events
+		unsigned sliceSize = message.ReadVLE();
+		for (unsigned i = 0; i < sliceSize && !message.IsEof(); i++)
+		{
+			Pending item;
+			item.correction_ = true;
+			item.event_.tick = tick;
+			item.event_.id = message.ReadVLE();
+			item.position_ = message.ReadVector3();
+			item.velocity_ = message.ReadVector3();
+			pending_.Push(item);
+		}
+		latestTick_ = tick;
+	}
+}
+
+void FlockSyncClient::Update(float timeStep)
+{
+	if (!active_)
+		return;
+
+	//run on the frame clock about delay behind the newest server tick, easing back when that drifts
+	//and jumping when it is far off, so the flock steps evenly even though the ticks arrive in bursts
+	float ticksPerSecond = 1.0f / timeStep_;
+	float target = latestTick_ - delay_ * ticksPerSecond;
+	clock_ += timeStep * ticksPerSecond;
+	if (Abs(clock_ - target) > 0.5f * ticksPerSecond)
+		clock_ = target;
+	else
+		clock_ += (target - clock_) * 0.05f;
+
+	ApplyPending();
+	//never past the newest server tick, events for later ticks may still be on their way
+	while (flock_.GetTick() < latestTick_ && (float)flock_.GetTick() < clock_)
+	{
+		flock_.Update(timeStep_);
+		ApplyPending();
+	}
+}
+
+void FlockSyncClient::ApplyPending()
+{
+	unsigned applied = 0;
+	while (applied < pending_.Size() && pending_[applied].event_.tick <= flock_.GetTick())
+	{
+		const Pending& item = pending_[applied++];
+		const FlockEvent& event = item.event_;
+		int index = flock_.GetIndex(event.id);
+		if (item.correction_)
+		{
+			if (index < 0)
+				continue;
+			//the boid jumps in the simulation but its node eases over from where it was drawn
+			const FlockState& state = flock_.state;
+			Vector3 drawn(state.px[index], state.py[index], state.pz[index]);
+			flock_.boidList[index].correction += drawn - item.position_;
+			flock_.SetBoidState(index, item.position_, item.velocity_);
+		}
+		else if (event.type == FLOCK_EVENT_SPAWN)
+		{
+			if (index < 0)
+				flock_.SpawnBoid(event.id, event.school, event.centre, event.spread);
+		}
+		else if (index >= 0)
+			flock_.Despawn(index);
+	}
+	if (applied > 0)
+		pending_.Erase(0, applied);
+}
+
+void FlockSyncClient::Clear()
+{
+	flock_.Clear();
+	pending_.Clear();
+	active_ = false;
+}
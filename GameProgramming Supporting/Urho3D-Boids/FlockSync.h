@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Urho3D/IO/VectorBuffer.h>
+
+#include "Boids.h"
+
+namespace Urho3D
+{
+	class Connection;
+	class MemoryBuffer;
+	class Network;
+}
+
+/// Reliable message with the whole flock, sent once to each client when it has loaded the scene.
+static const int MSG_FLOCKKEYFRAME = 0x82;
+/// Reliable message sent with every network update: the spawns and despawns since the last one and the
+/// exact state of a few boids.
+static const int MSG_FLOCKEVENTS = 0x83;
+/// Boids whose exact state goes out with every MSG_FLOCKEVENTS, cycling through the flock. The flock traffic
+/// stays about the same whatever the fish count, a bigger flock is just checked less often.
+static const unsigned FLOCK_KEYFRAME_SLICE = 8;
+
+/// Server side of the client simulated flock. The flock step only depends on the flock state, so clients given
+/// the same starting state, timestep and settings run the same flock. The server only sends what the step can
+/// not know: spawns and despawns from the event journal, each stamped with the tick it happened at, and a rolling
+/// slice of exact states to pull back a client that has drifted.
+class FlockSyncServer
+{
+public:
+	/// Construct.
+	FlockSyncServer();
+
+	/// Send the keyframe to clients that have just loaded the scene and this network frame's events to the rest,
+	/// then clear the flock's event journal.
+	void Send(BoidSet& boids, float timeStep, Network* network);
+	/// Forget a disconnected client.
+	void RemoveConnection(Connection* connection);
+
+private:
+	/// Write the whole flock.
+	void WriteKeyframe(const BoidSet& boids, float timeStep, VectorBuffer& message) const;
+
+	/// Clients that have had their keyframe.
+	PODVector<Connection*> synced_;
+	/// Next boidList index of the rolling keyframe slice.
+	unsigned nextSlice_;
+	VectorBuffer message_;
+};
+
+/// Client side of the client simulated flock. Runs its own BoidSet in kinematic mode a little behind the newest
+/// server tick, applying the server's events and state corrections at the tick they belong to.
+class FlockSyncClient
+{
+public:
+	/// Construct.
+	FlockSyncClient();
+
+	/// Start over in a new scene. Boids of the previous scene are not touched, they went with it.
+	void Initialise(ResourceCache* pRes, Scene* pScene);
+	/// Set how many seconds behind the newest server tick the flock is stepped.
+	void SetDelay(float delay) { delay_ = delay; }
+	/// Read a MSG_FLOCKKEYFRAME or MSG_FLOCKEVENTS.
+	void Read(int messageID, MemoryBuffer& message);
+	/// Step the flock towards the server tick, time step is the frame time.
+	void Update(float timeStep);
+	/// Remove the flock from the scene.
+	void Clear();
+	/// Return whether a keyframe has arrived and the client is running the flock.
+	bool IsActive() const { return active_; }
+
+private:
+	/// An event or a state correction waiting for the flock to reach its tick.
+	struct Pending
+	{
+		FlockEvent event_;
+		bool correction_;
+		Vector3 position_;
+		Vector3 velocity_;
+	};
+
+	/// Apply every pending item up to the current flock tick, in the order the server made them.
+	void ApplyPending();
+
+	ResourceCache* pRes_;
+	Scene* pScene_;
+	BoidSet flock_;
+	Vector<Pending> pending_;
+	/// Newest server tick heard of, the flock never steps past it.
+	unsigned latestTick_;
+	/// Fractional tick the flock is being stepped towards, runs on the frame time.
+	float clock_;
+	float timeStep_;
+	float delay_;
+	bool active_;
+};
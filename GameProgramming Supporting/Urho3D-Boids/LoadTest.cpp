@@ -0,0 +1,127 @@
+#include "Character.h"
+#include "LoadTest.h"
+
+#include <Urho3D/Container/Sort.h>
+
+SampleWindow::SampleWindow() :
+	next_(0)
+{
+}
+
+void SampleWindow::Push(float value)
+{
+	if (values_.Size() < SAMPLE_WINDOW_SIZE)
+	{
+		values_.Push(value);
+		return;
+	}
+	values_[next_] = value;
+	next_ = (next_ + 1) % SAMPLE_WINDOW_SIZE;
+}
+
+float SampleWindow::GetMin() const
+{
+	if (values_.Empty())
+		return 0.0f;
+	float result = values_[0];
+	for (unsigned i = 1; i < values_.Size(); i++)
+		result = Min(result, values_[i]);
+	return result;
+}
+
+float SampleWindow::GetMax() const
+{
+	if (values_.Empty())
+		return 0.0f;
+	float result = values_[0];
+	for (unsigned i = 1; i < values_.Size(); i++)
+		result = Max(result, values_[i]);
+	return result;
+}
+
+float SampleWindow::GetAverage() const
+{
+	if (values_.Empty())
+		return 0.0f;
+	float sum = 0.0f;
+	for (unsigned i = 0; i < values_.Size(); i++)
+		sum += values_[i];
+	return sum / values_.Size();
+}
+
+float SampleWindow::GetPercentile(float fraction) const
+{
+	if (values_.Empty())
+		return 0.0f;
+	//only called for reports every few seconds, sorting a copy is cheap enough
+	PODVector<float> sorted = values_;
+	Sort(sorted.Begin(), sorted.End());
+	unsigned index = (unsigned)(Clamp(fraction, 0.0f, 1.0f) * (sorted.Size() - 1) + 0.5f);
+	return sorted[index];
+}
+
+void SampleWindow::Clear()
+{
+	values_.Clear();
+	next_ = 0;
+}
+
+LoadTestBot::LoadTestBot() :
+	buttons_(0),
+	yaw_(0.0f),
+	pitch_(0.0f),
+	turnRate_(0.0f),
+	holdTime_(0.0f)
+{
+	Clear();
+}
+
+void LoadTestBot::Generate(Controls& controls, float timeStep)
+{
+	holdTime_ -= timeStep;
+	if (holdTime_ <= 0.0f)
+	{
+		//mostly swimming forward, sometimes strafing or backing off, sometimes still
+		buttons_ = 0;
+		if (Random(1.0f) < 0.7f)
+			buttons_ |= CTRL_FORWARD;
+		else if (Random(1.0f) < 0.3f)
+			buttons_ |= CTRL_BACK;
+		if (Random(1.0f) < 0.2f)
+			buttons_ |= Random(1.0f) < 0.5f ? CTRL_LEFT : CTRL_RIGHT;
+		turnRate_ = Random(-60.0f, 60.0f);
+		pitch_ = Random(-20.0f, 20.0f);
+		holdTime_ = Random(0.5f, 2.0f);
+	}
+	yaw_ += turnRate_ * timeStep;
+
+	controls.buttons_ = buttons_;
+	controls.yaw_ = yaw_;
+	controls.pitch_ = pitch_;
+}
+
+void LoadTestBot::InputSent(unsigned sequence, float time)
+{
+	sentSequence_[sequence % SENT_HISTORY] = sequence;
+	sentTime_[sequence % SENT_HISTORY] = time;
+}
+
+void LoadTestBot::ConeStateReceived(unsigned sequence, float time)
+{
+	//states repeat the last applied input until a newer one is applied, and may arrive out of order
+	for (unsigned s = Max(lastConfirmed_ + 1, sequence > SENT_HISTORY ? sequence - SENT_HISTORY + 1 : 1); s <= sequence; s++)
+	{
+		if (sentSequence_[s % SENT_HISTORY] == s)
+			latency_.Push((time - sentTime_[s % SENT_HISTORY]) * 1000.0f);
+	}
+	lastConfirmed_ = Max(lastConfirmed_, sequence);
+}
+
+void LoadTestBot::Clear()
+{
+	for (unsigned i = 0; i < SENT_HISTORY; i++)
+		sentSequence_[i] = 0;
+	lastConfirmed_ = 0;
+	latency_.Clear();
+	joined_ = false;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Input/Controls.h>
+
+using namespace Urho3D;
+
+/// Samples one SampleWindow keeps, about a minute of ticks at 60 per second.
+static const unsigned SAMPLE_WINDOW_SIZE = 4096;
+
+/// The most recent SAMPLE_WINDOW_SIZE values of a timing or size, with their minimum, mean and percentiles.
+class SampleWindow
+{
+public:
+	/// Construct empty.
+	SampleWindow();
+
+	/// Add a value, replacing the oldest once full.
+	void Push(float value);
+	/// Return the smallest value, 0 when empty.
+	float GetMin() const;
+	/// Return the largest value, 0 when empty.
+	float GetMax() const;
+	/// Return the mean, 0 when empty.
+	float GetAverage() const;
+	/// Return the value below which fraction of the values lie (0.99 for p99), 0 when empty.
+	float GetPercentile(float fraction) const;
+	unsigned GetSize() const { return values_.Size(); }
+	/// Remove all values.
+	void Clear();
+
+private:
+	PODVector<float> values_;
+	/// Slot the next value overwrites once full.
+	unsigned next_;
+};
+
+/// Synthetic player for load tests. Holds random movement buttons for a second or two at a time and turns slowly,
+/// so its cone wanders the tank like a player would, and times how long each input takes to come back confirmed
+/// in a MSG_CONESTATE: client to server, the server tick that applies it and the next network update back.
+class LoadTestBot
+{
+public:
+	/// Construct.
+	LoadTestBot();
+
+	/// Fill this tick's buttons, yaw and pitch.
+	void Generate(Controls& controls, float timeStep);
+	/// Note the time an input left in the controls.
+	void InputSent(unsigned sequence, float time);
+	/// Note a cone state from the server, every input it newly confirms adds a latency sample.
+	void ConeStateReceived(unsigned sequence, float time);
+	/// Return input to confirmation latencies in milliseconds.
+	SampleWindow& GetLatency() { return latency_; }
+	/// Set once the ready event has gone to the server.
+	void SetJoined(bool joined) { joined_ = joined; }
+	bool IsJoined() const { return joined_; }
+	/// Forget everything, on disconnect.
+	void Clear();
+
+private:
+	/// Send times of recent inputs, by sequence number modulo the size.
+	static const unsigned SENT_HISTORY = 64;
+
+	unsigned sentSequence_[SENT_HISTORY];
+	float sentTime_[SENT_HISTORY];
+	unsigned lastConfirmed_;
+	SampleWindow latency_;
+	unsigned buttons_;
+	float yaw_;
+	float pitch_;
+	/// Degrees per second the view is turning.
+	float turnRate_;
+	/// Seconds until new buttons and turn rate are picked.
+	float holdTime_;
+	bool joined_;
+};
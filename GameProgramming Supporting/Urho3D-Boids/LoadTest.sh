@@ -0,0 +1,66 @@
+#!/bin/sh
+# Server load test on one machine, no GPU needed: a headless server and a number of headless bot clients
+# over localhost, each logging a LOADTEST report line every few seconds. Prints the server's last report and
+# the bots' last reports averaged, with the worst bot latency alongside.
+#
+#   LoadTest.sh [clients] [seconds] [server flags...]
+#
+# clients defaults to 8 and seconds to 60. Any further flags go to the server, e.g. -boids 2000 -clientflock.
+# Set URHO_EXE to the game executable if it is not bin/UrhoTutorial next to this script.
+
+CLIENTS=${1:-8}
+DURATION=${2:-60}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+EXE=${URHO_EXE:-"$(cd "$(dirname "$0")" && pwd)/bin/UrhoTutorial"}
+REPORT=${REPORT_INTERVAL:-5}
+OUT=$(mktemp -d)
+
+"$EXE" -headless -loadreport "$REPORT" "$@" > "$OUT/server.log" 2>&1 &
+SERVER=$!
+# give the server time to load and start listening
+sleep 2
+
+BOTS=""
+i=0
+while [ "$i" -lt "$CLIENTS" ]; do
+	"$EXE" -bot -loadreport "$REPORT" > "$OUT/bot$i.log" 2>&1 &
+	BOTS="$BOTS $!"
+	i=$((i + 1))
+	# stagger the joins so the seeds and the scene downloads differ
+	sleep 0.1
+done
+
+echo "Running $CLIENTS clients for $DURATION seconds, logs in $OUT"
+sleep "$DURATION"
+kill $BOTS 2>/dev/null
+kill "$SERVER" 2>/dev/null
+wait
+
+grep LOADTEST "$OUT/server.log" | tail -n 1
+for f in "$OUT"/bot*.log; do
+	grep LOADTEST "$f" | tail -n 1
+done | awk '
+{
+	for (i = 3; i <= NF; i++)
+	{
+		split($i, kv, "=")
+		if (n == 0)
+			keys[++numKeys] = kv[1]
+		sum[kv[1]] += kv[2]
+		if (kv[1] == "latency_p99_ms" && kv[2] > worst)
+			worst = kv[2]
+	}
+	n++
+}
+END {
+	if (n == 0)
+	{
+		print "LOADTEST bots=0, no bot reported"
+		exit 1
+	}
+	printf "LOADTEST bots=%d", n
+	for (k = 1; k <= numKeys; k++)
+		printf " %s=%.2f", keys[k], sum[keys[k]] / n
+	printf " worst_latency_p99_ms=%.2f\n", worst
+}'
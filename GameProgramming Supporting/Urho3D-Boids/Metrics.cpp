@@ -0,0 +1,235 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Metrics.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+typedef SOCKET NativeSocket;
+static const int SEND_FLAGS = 0;
+static void CloseSocket(size_t socket) { closesocket((SOCKET)socket); }
+static bool SetNonBlocking(size_t socket, bool enable)
+{
+	u_long mode = enable ? 1 : 0;
+	return ioctlsocket((SOCKET)socket, FIONBIO, &mode) == 0;
+}
+#else
+typedef int NativeSocket;
+//a scraper hanging up mid response must not raise SIGPIPE and take the server down
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+static void CloseSocket(size_t socket) { close((int)socket); }
+static bool SetNonBlocking(size_t socket, bool enable)
+{
+	int flags = fcntl((int)socket, F_GETFL, 0);
+	if (flags < 0)
+		return false;
+	return fcntl((int)socket, F_SETFL, enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == 0;
+}
+#endif
+
+MetricsHistogram::MetricsHistogram(const float* bounds, unsigned numBounds) :
+	sum_(0.0),
+	count_(0)
+{
+	for (unsigned i = 0; i < numBounds; i++)
+		bounds_.Push(bounds[i]);
+	counts_.Resize(numBounds + 1);
+	for (unsigned i = 0; i < counts_.Size(); i++)
+		counts_[i] = 0;
+}
+
+void MetricsHistogram::Observe(float value)
+{
+	unsigned bucket = 0;
+	while (bucket < bounds_.Size() && value > bounds_[bucket])
+		bucket++;
+	counts_[bucket]++;
+	sum_ += value;
+	count_++;
+}
+
+void MetricsHistogram::Write(String& page, const char* name, const char* help) const
+{
+	WriteMetricHeader(page, name, "histogram", help);
+	unsigned cumulative = 0;
+	for (unsigned i = 0; i < bounds_.Size(); i++)
+	{
+		cumulative += counts_[i];
+		page.AppendWithFormat("%s_bucket{le=\"%g\"} %u\n", name, bounds_[i], cumulative);
+	}
+	page.AppendWithFormat("%s_bucket{le=\"+Inf\"} %u\n", name, count_);
+	page.AppendWithFormat("%s_sum %.6f\n", name, sum_);
+	page.AppendWithFormat("%s_count %u\n", name, count_);
+}
+
+void WriteMetricHeader(String& page, const char* name, const char* type, const char* help)
+{
+	page.AppendWithFormat("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void WriteMetricValue(String& page, const char* name, double value)
+{
+	page.AppendWithFormat("%s %.6g\n", name, value);
+}
+
+void WriteMetricValue(String& page, const char* name, const char* label, const String& labelValue, double value)
+{
+	page.AppendWithFormat("%s{%s=\"%s\"} %.6g\n", name, label, labelValue.CString(), value);
+}
+
+MetricsEndpoint::MetricsEndpoint() :
+	listener_(INVALID)
+{
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+	Stop();
+}
+
+bool MetricsEndpoint::Start(unsigned short port)
+{
+	Stop();
+#ifdef _WIN32
+	//reference counted, kNet has usually started Winsock already
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		return false;
+#endif
+	SocketHandle listener = (SocketHandle)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == INVALID)
+	{
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+	int reuse = 1;
+	setsockopt((NativeSocket)listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	//local only, a collector on the same machine scrapes every tank instance
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind((NativeSocket)listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+		listen((NativeSocket)listener, MAX_METRICS_SCRAPES) != 0 ||
+		!SetNonBlocking(listener, true))
+	{
+		CloseSocket(listener);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+	listener_ = listener;
+	return true;
+}
+
+void MetricsEndpoint::Stop()
+{
+	for (unsigned i = 0; i < scrapes_.Size(); i++)
+		CloseSocket(scrapes_[i].socket_);
+	scrapes_.Clear();
+	if (listener_ != INVALID)
+	{
+		CloseSocket(listener_);
+		listener_ = INVALID;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+}
+
+bool MetricsEndpoint::Poll(float timeStep)
+{
+	if (listener_ == INVALID)
+		return false;
+
+	while (scrapes_.Size() < MAX_METRICS_SCRAPES)
+	{
+		SocketHandle socket = (SocketHandle)accept((NativeSocket)listener_, nullptr, nullptr);
+		if (socket == INVALID)
+			break;
+		SetNonBlocking(socket, true);
+		Scrape scrape;
+		scrape.socket_ = socket;
+		scrape.age_ = 0.0f;
+		scrapes_.Push(scrape);
+	}
+
+	bool waiting = false;
+	for (unsigned i = 0; i < scrapes_.Size();)
+	{
+		Scrape& scrape = scrapes_[i];
+		scrape.age_ += timeStep;
+		char buffer[1024];
+		int received;
+		while ((received = (int)recv((NativeSocket)scrape.socket_, buffer, sizeof(buffer), 0)) > 0)
+			scrape.request_.Append(buffer, (unsigned)received);
+		//closed before sending a whole request, or too slow about it
+		bool complete = scrape.request_.Contains("\r\n\r\n") || scrape.request_.Contains("\n\n");
+		if ((received == 0 && !complete) || (!complete && scrape.age_ > METRICS_REQUEST_TIMEOUT))
+		{
+			CloseSocket(scrape.socket_);
+			scrapes_.Erase(i);
+			continue;
+		}
+		waiting |= complete;
+		++i;
+	}
+	return waiting;
+}
+
+void MetricsEndpoint::Respond(const String& page)
+{
+	for (unsigned i = 0; i < scrapes_.Size();)
+	{
+		Scrape& scrape = scrapes_[i];
+		if (!scrape.request_.Contains("\r\n\r\n") && !scrape.request_.Contains("\n\n"))
+		{
+			++i;
+			continue;
+		}
+		Vector<String> requestLine = scrape.request_.Substring(0, scrape.request_.Find('\n')).Trimmed().Split(' ');
+		String path = requestLine.Size() > 1 ? requestLine[1] : String::EMPTY;
+		if (requestLine.Size() > 1 && requestLine[0] == "GET" && (path == "/metrics" || path == "/"))
+			Send(scrape, "200 OK", page);
+		else
+			Send(scrape, "404 Not Found", "Metrics are at /metrics\n");
+		scrapes_.Erase(i);
+	}
+}
+
+void MetricsEndpoint::Send(Scrape& scrape, const String& status, const String& body)
+{
+	String response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+		String(body.Length()) + "\r\nConnection: close\r\n\r\n" + body;
+	//the page is a few kilobytes, blocking until it is in the socket buffer costs nothing
+	SetNonBlocking(scrape.socket_, false);
+	const char* data = response.CString();
+	unsigned left = response.Length();
+	while (left > 0)
+	{
+		int sent = (int)send((NativeSocket)scrape.socket_, data, left, SEND_FLAGS);
+		if (sent <= 0)
+			break;
+		data += sent;
+		left -= sent;
+	}
+	CloseSocket(scrape.socket_);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/Vector.h>
+
+using namespace Urho3D;
+
+/// Seconds between rewrites of the -metricsfile page.
+static const float METRICS_FILE_INTERVAL = 1.0f;
+/// Scrapes answered at once, further connections wait in the listen backlog.
+static const unsigned MAX_METRICS_SCRAPES = 8;
+/// Seconds a scrape may take to send its request before it is dropped.
+static const float METRICS_REQUEST_TIMEOUT = 2.0f;
+
+/// Cumulative histogram with fixed upper bounds, written in the Prometheus text format.
+class MetricsHistogram
+{
+public:
+	/// Construct with ascending bucket upper bounds, a +Inf bucket is always added.
+	MetricsHistogram(const float* bounds, unsigned numBounds);
+
+	/// Count a value into its bucket.
+	void Observe(float value);
+	/// Append the HELP, TYPE, bucket, sum and count lines.
+	void Write(String& page, const char* name, const char* help) const;
+
+private:
+	PODVector<float> bounds_;
+	/// Values at or below each bound, not yet cumulative. The last counts the values above every bound.
+	PODVector<unsigned> counts_;
+	double sum_;
+	unsigned count_;
+};
+
+/// Append the HELP and TYPE lines of a counter or gauge.
+void WriteMetricHeader(String& page, const char* name, const char* type, const char* help);
+/// Append one unlabelled sample.
+void WriteMetricValue(String& page, const char* name, double value);
+/// Append one sample with a single label.
+void WriteMetricValue(String& page, const char* name, const char* label, const String& labelValue, double value);
+
+/// Plain HTTP text endpoint on a local port, polled from the main loop. Every GET of /metrics gets the page the
+/// caller builds, anything else a 404, then the connection is closed. Nothing blocks: the listening socket and
+/// every scrape are non-blocking, and a scrape that does not finish its request in time is dropped.
+class MetricsEndpoint
+{
+public:
+	/// Construct stopped.
+	MetricsEndpoint();
+	/// Destruct, closing every socket.
+	~MetricsEndpoint();
+
+	/// Listen on a port of the loopback interface. Return false when the port cannot be bound.
+	bool Start(unsigned short port);
+	/// Close the listening socket and drop every scrape.
+	void Stop();
+	/// Accept new scrapes and read their requests. Return true when at least one is waiting for the page.
+	bool Poll(float timeStep);
+	/// Answer every scrape that is waiting for the page, then close it.
+	void Respond(const String& page);
+	bool IsRunning() const { return listener_ != INVALID; }
+
+private:
+	/// Socket handle wide enough for both Winsock and POSIX.
+	typedef size_t SocketHandle;
+	static const SocketHandle INVALID = (SocketHandle)-1;
+
+	struct Scrape
+	{
+		SocketHandle socket_;
+		/// Request received so far.
+		String request_;
+		/// Seconds since it was accepted.
+		float age_;
+	};
+
+	/// Send a whole response and close the scrape.
+	void Send(Scrape& scrape, const String& status, const String& body);
+
+	SocketHandle listener_;
+	Vector<Scrape> scrapes_;
+};
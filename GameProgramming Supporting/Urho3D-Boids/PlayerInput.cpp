@@ -0,0 +1,145 @@
+#include "Character.h"
+#include "PlayerInput.h"
+
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+// Controls extra data key of the unconfirmed inputs: first sequence number, count, then each input
+static const StringHash PLAYER_INPUTS("INPUTS");
+
+void MoveCone(Vector3& position, Quaternion& rotation, const PlayerInput& input, float timeStep)
+{
+	rotation = Quaternion(input.pitch_, input.yaw_, 0.0f);
+	Vector3 direction = Vector3::ZERO;
+	if (input.buttons_ & CTRL_FORWARD)
+		direction += Vector3::FORWARD;
+	if (input.buttons_ & CTRL_BACK)
+		direction += Vector3::BACK;
+	if (input.buttons_ & CTRL_LEFT)
+		direction += Vector3::LEFT;
+	if (input.buttons_ & CTRL_RIGHT)
+		direction += Vector3::RIGHT;
+	position += rotation * (direction * CONE_MOVE_SPEED * timeStep);
+}
+
+PlayerInputQueue::PlayerInputQueue() :
+	lastReceived_(0),
+	lastApplied_(0)
+{
+}
+
+void PlayerInputQueue::Read(const Controls& controls)
+{
+	VariantMap::ConstIterator it = controls.extraData_.Find(PLAYER_INPUTS);
+	if (it == controls.extraData_.End())
+		return;
+	MemoryBuffer message(it->second_.GetBuffer());
+	unsigned sequence = message.ReadUInt();
+	unsigned count = message.ReadVLE();
+	for (unsigned i = 0; i < count && !message.IsEof(); i++, sequence++)
+	{
+		PlayerInput input;
+		input.sequence_ = sequence;
+		input.buttons_ = message.ReadVLE();
+		input.yaw_ = message.ReadFloat();
+		input.pitch_ = message.ReadFloat();
+		input.timeStep_ = 0.0f;
+		//every controls update resends the inputs since the last confirmed one, most are duplicates
+		if (sequence <= lastReceived_)
+			continue;
+		pending_.Push(input);
+		lastReceived_ = sequence;
+	}
+}
+
+bool PlayerInputQueue::Pop(PlayerInput& input)
+{
+	if (pending_.Empty())
+		return false;
+	input = pending_.Front();
+	pending_.Erase(0);
+	lastApplied_ = input.sequence_;
+	return true;
+}
+
+void PlayerInputQueue::Discard()
+{
+	pending_.Clear();
+	lastApplied_ = lastReceived_;
+}
+
+PlayerPredictor::PlayerPredictor() :
+	nextSequence_(1),
+	lastConfirmed_(0),
+	active_(false)
+{
+}
+
+void PlayerPredictor::Step(Controls& controls, float timeStep)
+{
+	PlayerInput input;
+	input.sequence_ = nextSequence_++;
+	input.buttons_ = controls.buttons_;
+	input.yaw_ = controls.yaw_;
+	input.pitch_ = controls.pitch_;
+	input.timeStep_ = timeStep;
+	if (unconfirmed_.Size() == MAX_PENDING_INPUTS)
+		unconfirmed_.Erase(0);
+	unconfirmed_.Push(input);
+
+	if (active_)
+	{
+		error_ *= 0.9f;
+		MoveCone(position_, rotation_, input, timeStep);
+	}
+
+	VectorBuffer inputs;
+	inputs.WriteUInt(unconfirmed_.Front().sequence_);
+	inputs.WriteVLE(unconfirmed_.Size());
+	for (unsigned i = 0; i < unconfirmed_.Size(); i++)
+	{
+		inputs.WriteVLE(unconfirmed_[i].buttons_);
+		inputs.WriteFloat(unconfirmed_[i].yaw_);
+		inputs.WriteFloat(unconfirmed_[i].pitch_);
+	}
+	controls.extraData_[PLAYER_INPUTS] = inputs;
+}
+
+void PlayerPredictor::Reconcile(MemoryBuffer& message)
+{
+	unsigned sequence = message.ReadUInt();
+	Vector3 position = message.ReadVector3();
+	//unreliable, so an older state can arrive after a newer one
+	if (active_ && sequence < lastConfirmed_)
+		return;
+	lastConfirmed_ = sequence;
+
+	unsigned confirmed = 0;
+	while (confirmed < unconfirmed_.Size() && unconfirmed_[confirmed].sequence_ <= sequence)
+		confirmed++;
+	if (confirmed > 0)
+		unconfirmed_.Erase(0, confirmed);
+
+	//start again from the server's position and redo what it has not seen yet
+	Vector3 predicted = position_;
+	position_ = position;
+	for (unsigned i = 0; i < unconfirmed_.Size(); i++)
+		MoveCone(position_, rotation_, unconfirmed_[i], unconfirmed_[i].timeStep_);
+
+	if (active_)
+	{
+		error_ += predicted - position_;
+		if (error_.Length() > CONE_SNAP_DISTANCE)
+			error_ = Vector3::ZERO;
+	}
+	active_ = true;
+}
+
+void PlayerPredictor::Clear()
+{
+	unconfirmed_.Clear();
+	nextSequence_ = 1;
+	lastConfirmed_ = 0;
+	error_ = Vector3::ZERO;
+	active_ = false;
+}
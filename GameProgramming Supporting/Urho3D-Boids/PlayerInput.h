@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Input/Controls.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+namespace Urho3D
+{
+	class MemoryBuffer;
+}
+
+using namespace Urho3D;
+
+/// Unreliable message from the server to each player: the last input sequence number applied to their cone and
+/// the cone's position after it.
+static const int MSG_CONESTATE = 0x84;
+/// Inputs a client keeps resending in its controls until the server confirms them, half a second at 60 ticks.
+static const unsigned MAX_PENDING_INPUTS = 32;
+/// Inputs the server lets queue up for one player before it applies more than one a tick to catch up.
+static const unsigned PLAYER_INPUT_BACKLOG = 4;
+/// Player cone speed in units per second.
+static const float CONE_MOVE_SPEED = 15.0f;
+/// Reconciliation error beyond which the predicted cone jumps instead of easing over.
+static const float CONE_SNAP_DISTANCE = 3.0f;
+
+/// One tick of a player's controls.
+struct PlayerInput
+{
+	/// Counts up by one every client tick.
+	unsigned sequence_;
+	unsigned buttons_;
+	float yaw_;
+	float pitch_;
+	/// Client tick length, only kept on the client for replaying.
+	float timeStep_;
+};
+
+/// Move a player cone by one tick of input. The server moves the real cone and the client its prediction with this,
+/// so the two agree whenever they were given the same inputs.
+void MoveCone(Vector3& position, Quaternion& rotation, const PlayerInput& input, float timeStep);
+
+/// Server side: inputs from one client, applied one per tick in the order the client made them.
+class PlayerInputQueue
+{
+public:
+	/// Construct empty.
+	PlayerInputQueue();
+
+	/// Take the inputs of a controls update that have not been seen yet.
+	void Read(const Controls& controls);
+	/// Take the oldest input. Return false when there is none.
+	bool Pop(PlayerInput& input);
+	/// Drop every waiting input as if applied, while the player has no cone.
+	void Discard();
+	unsigned GetSize() const { return pending_.Size(); }
+	/// Return the sequence number of the last input taken.
+	unsigned GetLastApplied() const { return lastApplied_; }
+
+private:
+	PODVector<PlayerInput> pending_;
+	unsigned lastReceived_;
+	unsigned lastApplied_;
+};
+
+/// Client side: moves the player's own cone straight away from its inputs and, when the server's position for an
+/// input arrives, starts again from there and replays the inputs the server has not applied yet.
+class PlayerPredictor
+{
+public:
+	/// Construct.
+	PlayerPredictor();
+
+	/// Record and apply this tick's controls, then put every unconfirmed input into their extra data for the server.
+	void Step(Controls& controls, float timeStep);
+	/// Read a MSG_CONESTATE.
+	void Reconcile(MemoryBuffer& message);
+	/// Return the cone position to draw, the prediction plus what is left of the last correction.
+	Vector3 GetPosition() const { return position_ + error_; }
+	const Quaternion& GetRotation() const { return rotation_; }
+	/// Return the sequence number of the last input stepped.
+	unsigned GetLastSequence() const { return nextSequence_ - 1; }
+	/// Return whether a server state has arrived, before that there is nothing to predict from.
+	bool IsActive() const { return active_; }
+	/// Forget everything, on disconnect.
+	void Clear();
+
+private:
+	/// Inputs not yet confirmed by the server, oldest first.
+	PODVector<PlayerInput> unconfirmed_;
+	unsigned nextSequence_;
+	unsigned lastConfirmed_;
+	Vector3 position_;
+	Quaternion rotation_;
+	/// Visual offset left by a correction, shrinks every tick.
+	Vector3 error_;
+	bool active_;
+};
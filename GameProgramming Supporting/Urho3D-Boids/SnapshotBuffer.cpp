@@ -0,0 +1,94 @@
+#include "SnapshotBuffer.h"
+
+SnapshotBuffer::SnapshotBuffer() :
+	first_(0),
+	count_(0),
+	interval_(0.0f)
+{
+}
+
+void SnapshotBuffer::Add(float time, const Vector3& position, const Quaternion& rotation)
+{
+	if (count_ > 0)
+	{
+		State& newest = states_[(first_ + count_ - 1) % SNAPSHOT_BUFFER_SIZE];
+		if (time <= newest.time_)
+		{
+			newest.position_ = position;
+			newest.rotation_ = rotation;
+			return;
+		}
+		//a slow moving average, one late packet should not pull the render time back
+		float gap = time - newest.time_;
+		interval_ = interval_ > 0.0f ? Lerp(interval_, gap, 0.1f) : gap;
+	}
+
+	if (count_ == SNAPSHOT_BUFFER_SIZE)
+	{
+		first_ = (first_ + 1) % SNAPSHOT_BUFFER_SIZE;
+		count_--;
+	}
+	State& state = states_[(first_ + count_) % SNAPSHOT_BUFFER_SIZE];
+	state.time_ = time;
+	state.position_ = position;
+	state.rotation_ = rotation;
+	count_++;
+}
+
+bool SnapshotBuffer::Sample(float time, Vector3& position, Quaternion& rotation) const
+{
+	if (count_ == 0)
+		return false;
+
+	const State& oldest = At(0);
+	const State& newest = At(count_ - 1);
+	if (count_ == 1 || time <= oldest.time_)
+	{
+		position = oldest.position_;
+		rotation = oldest.rotation_;
+		return true;
+	}
+
+	if (time >= newest.time_)
+	{
+		//packet late or lost: keep going at the last known velocity for a moment rather than stopping dead
+		const State& previous = At(count_ - 2);
+		float ahead = Min(time - newest.time_, SNAPSHOT_MAX_EXTRAPOLATION);
+		Vector3 velocity = (newest.position_ - previous.position_) / (newest.time_ - previous.time_);
+		position = newest.position_ + velocity * ahead;
+		rotation = newest.rotation_;
+		return true;
+	}
+
+	unsigned i = count_ - 1;
+	while (At(i - 1).time_ > time)
+		i--;
+	const State& from = At(i - 1);
+	const State& to = At(i);
+	float t = (time - from.time_) / (to.time_ - from.time_);
+	position = from.position_.Lerp(to.position_, t);
+	rotation = from.rotation_.Slerp(to.rotation_, t);
+	return true;
+}
+
+bool SnapshotBuffer::GetLatest(Vector3& position, Quaternion& rotation) const
+{
+	if (count_ == 0)
+		return false;
+	const State& newest = At(count_ - 1);
+	position = newest.position_;
+	rotation = newest.rotation_;
+	return true;
+}
+
+float SnapshotBuffer::GetLatestTime() const
+{
+	return count_ > 0 ? At(count_ - 1).time_ : -M_INFINITY;
+}
+
+void SnapshotBuffer::Clear()
+{
+	first_ = 0;
+	count_ = 0;
+	interval_ = 0.0f;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+using namespace Urho3D;
+
+/// Server states one SnapshotBuffer keeps.
+static const unsigned SNAPSHOT_BUFFER_SIZE = 16;
+/// Default seconds behind the newest update that clients render replicated objects.
+static const float DEFAULT_INTERPOLATION_DELAY = 0.1f;
+/// Longest a buffer runs on past its newest state before holding still.
+static const float SNAPSHOT_MAX_EXTRAPOLATION = 0.25f;
+
+/// Recent server states of one replicated object, stamped with the client time they arrived. Sampling a
+/// little in the past interpolates between two real states, so updates arriving at a low or uneven rate
+/// still render as smooth motion.
+class SnapshotBuffer
+{
+public:
+	/// Construct empty.
+	SnapshotBuffer();
+
+	/// Add a state received at time. A state with the same time as the newest replaces it, so updates that
+	/// arrive together, or position and rotation arriving separately, merge into one.
+	void Add(float time, const Vector3& position, const Quaternion& rotation);
+	/// Sample at time: interpolate between the states around it, extrapolate from the newest two for up to
+	/// SNAPSHOT_MAX_EXTRAPOLATION past the newest, then hold. Return false when empty.
+	bool Sample(float time, Vector3& position, Quaternion& rotation) const;
+	/// Return the newest state. Return false when empty.
+	bool GetLatest(Vector3& position, Quaternion& rotation) const;
+	/// Return the arrival time of the newest state, or -M_INFINITY when empty.
+	float GetLatestTime() const;
+	/// Return the smoothed time between updates.
+	float GetInterval() const { return interval_; }
+	/// Remove all states.
+	void Clear();
+	/// Return whether there are no states.
+	bool Empty() const { return count_ == 0; }
+
+private:
+	struct State
+	{
+		float time_;
+		Vector3 position_;
+		Quaternion rotation_;
+	};
+
+	/// Return the i-th oldest state.
+	const State& At(unsigned i) const { return states_[(first_ + i) % SNAPSHOT_BUFFER_SIZE]; }
+
+	State states_[SNAPSHOT_BUFFER_SIZE];
+	unsigned first_;
+	unsigned count_;
+	float interval_;
+};
@@ -0,0 +1,37 @@
+#include "TickProfile.h"
+
+static const char* phaseNames[MAX_TICK_PHASES] =
+{
+	"Tick",
+	"ClientControls",
+	"FlockStep",
+	"RespawnBoids",
+	"ReadBoids",
+	"GridBoids",
+	"ComputeForce",
+	"IntegrateBoids",
+	"WriteBoids",
+	"EatFish",
+	"Replication"
+};
+
+String TickProfile::ToString() const
+{
+	String result;
+	for (unsigned i = 0; i < MAX_TICK_PHASES; i++)
+	{
+		const SampleWindow& window = phases_[i];
+		if (!window.GetSize())
+			continue;
+		if (!result.Empty())
+			result += " ";
+		result.AppendWithFormat("%s=%.3f/%.3f/%.3f", phaseNames[i], window.GetMin(), window.GetAverage(),
+			window.GetPercentile(0.99f));
+	}
+	return result;
+}
+
+const char* TickProfile::GetPhaseName(TickPhase phase)
+{
+	return phaseNames[phase];
+}
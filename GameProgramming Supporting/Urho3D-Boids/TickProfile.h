@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Container/Str.h>
+
+#include "LoadTest.h"
+
+using namespace Urho3D;
+
+/// Default seconds between phase timing logs of a headless server.
+static const float DEFAULT_PROFILE_LOG_INTERVAL = 10.0f;
+
+/// Stages of a server tick. Each but the whole tick is also a URHO3D_PROFILE block of the same name, so the DebugHud
+/// profiler shows them.
+enum TickPhase
+{
+	/// Whole tick, physics pre-step to post-step.
+	PHASE_TICK = 0,
+	/// Applying the queued player inputs to their cones.
+	PHASE_CONTROLS,
+	/// The whole flock update, the phases below up to the write back.
+	PHASE_FLOCKSTEP,
+	/// Bringing eaten fish back.
+	PHASE_RESPAWN,
+	/// Copying rigid body states into the flock state.
+	PHASE_READSTATE,
+	/// Rebuilding the flock spatial index.
+	PHASE_GRIDBOIDS,
+	/// Neighbour search and steering forces, one streamed pass in the flock core.
+	PHASE_COMPUTEFORCE,
+	/// Kinematic integration of the flock state.
+	PHASE_INTEGRATE,
+	/// Writing forces or transforms back to the rigid bodies or nodes.
+	PHASE_WRITEBACK,
+	/// Players eating the fish within reach.
+	PHASE_COLLISION,
+	/// Writing the network update, cone states and the flock stream.
+	PHASE_REPLICATION,
+	MAX_TICK_PHASES
+};
+
+/// Rolling timings of every tick phase in milliseconds.
+class TickProfile
+{
+public:
+	/// Add a timing to a phase.
+	void Record(TickPhase phase, float milliseconds) { phases_[phase].Push(milliseconds); }
+	/// Return the timings of a phase.
+	const SampleWindow& Get(TickPhase phase) const { return phases_[phase]; }
+	/// Return one line of phase=min/avg/p99 milliseconds for the log, phases with no timings left out.
+	String ToString() const;
+	/// Return the name of a phase.
+	static const char* GetPhaseName(TickPhase phase);
+
+private:
+	SampleWindow phases_[MAX_TICK_PHASES];
+};
+
+/// Time a scope into a tick profile phase. Does nothing without a profile.
+class PhaseTimer
+{
+public:
+	/// Construct and start timing.
+	PhaseTimer(TickProfile* profile, TickPhase phase) :
+		profile_(profile),
+		phase_(phase)
+	{
+	}
+
+	/// Record the time since construction.
+	~PhaseTimer()
+	{
+		if (profile_)
+			profile_->Record(phase_, timer_.GetUSec(false) / 1000.0f);
+	}
+
+private:
+	TickProfile* profile_;
+	TickPhase phase_;
+	HiresTimer timer_;
+};